@@ -1,51 +1,148 @@
 #include <Rcpp.h>
 #include <math.h>       // power
-#include <cmath> 
+#include <cmath>
+#include <algorithm>    // swap, max
+#include <vector>
 using namespace Rcpp;
 
+// The maximization for the productivity state whose output and expected value columns are
+// given, by the monotone walk: value and policy go to valueColumn and policyColumn
+static void MaximizeColumn(const double* vGridCapital, const double* outputColumn, const double* expectedColumn, double bbeta,
+                           int nGridCapital, double* valueColumn, double* policyColumn, int* policyIndexColumn){
+
+    double valueProvisional, valueHighSoFar, consumption, capitalChoice;
+    int nCapital, nCapitalNextPeriod, gridCapitalNextPeriod;
+
+    // We start from previous choice (monotonicity of policy function)
+    gridCapitalNextPeriod = 0;
+
+    for (nCapital = 0;nCapital<nGridCapital;++nCapital){
+
+      valueHighSoFar = -100000.0;
+      capitalChoice  = vGridCapital[0];
+
+      for (nCapitalNextPeriod = gridCapitalNextPeriod;nCapitalNextPeriod<nGridCapital;++nCapitalNextPeriod){
+
+        consumption = outputColumn[nCapital]-vGridCapital[nCapitalNextPeriod];
+        valueProvisional = (1-bbeta)*log(consumption)+bbeta*expectedColumn[nCapitalNextPeriod];
+
+        if (valueProvisional>valueHighSoFar){
+          valueHighSoFar = valueProvisional;
+          capitalChoice = vGridCapital[nCapitalNextPeriod];
+          gridCapitalNextPeriod = nCapitalNextPeriod;
+        }
+        else{
+          break; // We break when we have achieved the max
+        }
+
+        valueColumn[nCapital] = valueHighSoFar;
+        policyColumn[nCapital] = capitalChoice;
+        policyIndexColumn[nCapital] = nCapitalNextPeriod+1;
+      }
+
+    }
+}
+
+// One maximization step, for a value function iteration driven from R. Sizes come from
+// expectedValueFunction; the result has the new value function in its first
+// nGridProductivity columns and the policy function in the rest.
 // [[Rcpp::export]]
-NumericMatrix InsideLoop(NumericVector vGridCapital, NumericMatrix mOutput, NumericMatrix expectedValueFunction){
-  
-    const double bbeta  = 0.95;
-    const int nGridCapital = 17820, nGridProductivity = 5;
-    
+NumericMatrix InsideLoop(NumericVector vGridCapital, NumericMatrix mOutput, NumericMatrix expectedValueFunction, double bbeta = 0.95){
+
+    const int nGridCapital = expectedValueFunction.nrow(), nGridProductivity = expectedValueFunction.ncol();
+
+    if (vGridCapital.size() != nGridCapital || mOutput.nrow() != nGridCapital || mOutput.ncol() != nGridProductivity){
+      stop("vGridCapital, mOutput and expectedValueFunction must have nGridCapital rows");
+    }
+
     NumericMatrix results(nGridCapital,2*nGridProductivity);
-    double valueProvisional, valueHighSoFar, consumption, capitalChoice;
-    
-    int nProductivity, nCapital, nCapitalNextPeriod, gridCapitalNextPeriod;
+    std::vector<int> policyIndexColumn(nGridCapital);
 
-    for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+    for (int nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+      MaximizeColumn(&vGridCapital[0],&mOutput(0,nProductivity),&expectedValueFunction(0,nProductivity),bbeta,nGridCapital,
+                     &results(0,nProductivity),&results(0,nGridProductivity+nProductivity),&policyIndexColumn[0]);
+    }
+
+  return results;
+
+}
+
+// The whole value function iteration in one call: the expectation, the maximization and the
+// convergence test of every iteration run here, on buffers allocated once, so R only sees
+// the result. Sizes come from the inputs; mTransition is by rows as in RBC_Rcpp.R (element
+// (nProductivity,nProductivityNextPeriod) is the probability of moving between them). Every
+// reportEvery iterations (0 for never) the progress is printed as RBC_Rcpp.R did. If
+// maxIterations is reached first, the result is returned with an R warning.
+// [[Rcpp::export]]
+List SolveRBC(NumericVector vGridCapital, NumericMatrix mOutput, NumericMatrix mTransition, double bbeta = 0.95,
+              double tolerance = 0.0000001, int maxIterations = 10000, int reportEvery = 10){
+
+    const int nGridCapital = mOutput.nrow(), nGridProductivity = mOutput.ncol();
+
+    if (vGridCapital.size() != nGridCapital || mTransition.nrow() != nGridProductivity || mTransition.ncol() != nGridProductivity){
+      stop("vGridCapital must have a point for each row of mOutput and mTransition a row and column for each of its columns");
+    }
 
-      // We start from previous choice (monotonicity of policy function)
-      gridCapitalNextPeriod = 0;
+    NumericMatrix mValueFunction(nGridCapital,nGridProductivity);
+    NumericMatrix mPolicyFunction(nGridCapital,nGridProductivity);
+    IntegerMatrix mPolicyIndex(nGridCapital,nGridProductivity);
+    std::vector<double> vValueFunction(nGridCapital*nGridProductivity, 0.0);
+    std::vector<double> vValueFunctionNew(nGridCapital*nGridProductivity, 0.0);
+    std::vector<double> vPolicyFunction(nGridCapital*nGridProductivity, 0.0);
+    std::vector<double> expectedValueFunction(nGridCapital*nGridProductivity, 0.0);
+    std::vector<int> vPolicyIndex(nGridCapital*nGridProductivity, 1);
+    const double* vGrid = &vGridCapital[0];
 
-      for (nCapital = 0;nCapital<nGridCapital;++nCapital){
+    double maxDifference = 10.0;
+    int iteration = 0;
 
-	      valueHighSoFar = -100000.0;
-	      capitalChoice  = vGridCapital[0];
+    while (maxDifference>tolerance && iteration<maxIterations){
 
-	      for (nCapitalNextPeriod = gridCapitalNextPeriod;nCapitalNextPeriod<nGridCapital;++nCapitalNextPeriod){
+      // expectedValueFunction = mValueFunction %*% t(mTransition), a column at a time
+      for (int nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+        double* expectedColumn = &expectedValueFunction[nProductivity*nGridCapital];
+        std::fill(expectedColumn,expectedColumn+nGridCapital,0.0);
+        for (int nProductivityNextPeriod = 0;nProductivityNextPeriod<nGridProductivity;++nProductivityNextPeriod){
+          const double probability = mTransition(nProductivity,nProductivityNextPeriod);
+          const double* valueColumn = &vValueFunction[nProductivityNextPeriod*nGridCapital];
+          if (probability != 0.0){
+            for (int nCapital = 0;nCapital<nGridCapital;++nCapital){
+              expectedColumn[nCapital] += probability*valueColumn[nCapital];
+            }
+          }
+        }
+      }
 
-	        consumption = mOutput(nCapital,nProductivity)-vGridCapital(nCapitalNextPeriod);
-	        valueProvisional = (1-bbeta)*log(consumption)+bbeta*expectedValueFunction(nCapitalNextPeriod,nProductivity);
-          
-	        if (valueProvisional>valueHighSoFar){
-	          valueHighSoFar = valueProvisional;
-	          capitalChoice = vGridCapital(nCapitalNextPeriod);
-	          gridCapitalNextPeriod = nCapitalNextPeriod;
-	        }
-	        else{
-	          break; // We break when we have achieved the max
-	        }
+      for (int nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+        MaximizeColumn(vGrid,&mOutput(0,nProductivity),&expectedValueFunction[nProductivity*nGridCapital],bbeta,nGridCapital,
+                       &vValueFunctionNew[nProductivity*nGridCapital],&vPolicyFunction[nProductivity*nGridCapital],
+                       &vPolicyIndex[nProductivity*nGridCapital]);
+      }
 
-	        results(nCapital,nProductivity) = valueHighSoFar;
-          results(nCapital,nGridProductivity+nProductivity) = capitalChoice;
-	      }
+      maxDifference = 0.0;
+      for (int nState = 0;nState<nGridCapital*nGridProductivity;++nState){
+        maxDifference = std::max(maxDifference,fabs(vValueFunctionNew[nState]-vValueFunction[nState]));
+      }
+      vValueFunction.swap(vValueFunctionNew);
 
+      iteration = iteration+1;
+      if (reportEvery > 0 && ((iteration % reportEvery)==0 || iteration ==1)){
+        Rcout << "  Iteration =  " << iteration << "  Sup Diff =  " << maxDifference << "\n";
       }
+      checkUserInterrupt();
+    }
 
+    if (maxDifference>tolerance){
+      Rcpp::warning("SolveRBC stopped after %d iterations with Sup Diff = %g, above the tolerance %g",
+                    iteration,maxDifference,tolerance);
     }
- 
-  return results;
-   
+
+    std::copy(vValueFunction.begin(),vValueFunction.end(),mValueFunction.begin());
+    std::copy(vPolicyFunction.begin(),vPolicyFunction.end(),mPolicyFunction.begin());
+    std::copy(vPolicyIndex.begin(),vPolicyIndex.end(),mPolicyIndex.begin());
+
+  return List::create(Named("valueFunction") = mValueFunction, Named("policyFunction") = mPolicyFunction,
+                      Named("policyIndex") = mPolicyIndex, Named("iterations") = iteration,
+                      Named("supDiff") = maxDifference);
+
 }
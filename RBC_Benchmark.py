@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+# ============================================================================
+# Name        : RBC_Benchmark.py
+# Description : Benchmark harness for the C and C++ versions. Builds every variant and
+#               solver mode, runs each with warm-ups and repetitions on one pinned CPU,
+#               times all of them with the same wall clock, and checks the policy check
+#               value each prints and, for the library drivers, the whole policy against
+#               the default driver's. A variant that fails to build or to run is reported
+#               and counted, and the others still run.
+# ============================================================================
+
+import argparse
+import array
+import math
+import os
+import re
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+# (name, source, extra compiler flags, arguments, check, policy tolerance). Every mode
+# solves the default model. The grid-search modes (check None) must reproduce the check of
+# the first variant. The endogenous grid and spline engines choose capital between grid
+# points, so their policy at the check point differs from grid search by a fraction of a
+# grid step and is compared with its own value instead.
+# The policy tolerance is the largest difference, in grid points, allowed between a
+# variant's policy indices and those of the default driver. The drivers write their
+# solution with -x, which the harness reads; RBC_CPP_Threads.cpp prints a checksum of its
+# policy indices, which must match exactly (tolerance 0). The original programs print
+# neither (tolerance None), so only their check is compared. Multigrid starts the fine
+# grid from an interpolated coarse policy and may settle one grid point away where two
+# choices are almost equally good, and the endogenous grid and spline indices are those of
+# the grid point below a policy between grid points.
+VARIANTS = [
+    ("C",                       "RBC_C.c",             [], [], None, None),
+    ("C2",                      "RBC_C2.c",            [], [], None, None),
+    ("CPP",                     "RBC_CPP.cpp",         [], [], None, None),
+    ("CPP_2",                   "RBC_CPP_2.cpp",       [], [], None, None),
+    ("Driver",                  "RBC_CPP_Driver.cpp",  [], [], None, 0),
+    ("Driver column",           "RBC_CPP_Driver.cpp",  [], ["-a", "column"], None, 0),
+    ("Driver vector",           "RBC_CPP_Driver.cpp",  [], ["-e", "vector"], None, 0),
+    ("Driver binary",           "RBC_CPP_Driver.cpp",  [], ["-e", "binary"], None, 0),
+    ("Driver fused",            "RBC_CPP_Driver.cpp",  [], ["-s", "fused"], None, 0),
+    ("Driver bounds",           "RBC_CPP_Driver.cpp",  [], ["-c", "bounds"], None, 0),
+    ("Driver howard 10",        "RBC_CPP_Driver.cpp",  [], ["-k", "10"], None, 0),
+    ("Driver multigrid 16",     "RBC_CPP_Driver.cpp",  [], ["-m", "16"], None, 1),
+    ("Driver multigrid howard", "RBC_CPP_Driver.cpp",  [], ["-m", "64", "-k", "10"], None, 1),
+    ("Driver utility cache",    "RBC_CPP_Driver.cpp",  [], ["-r", "4"], None, 0),
+    ("Driver fastest",          "RBC_CPP_Driver.cpp",  [], ["-k", "10", "-c", "bounds", "-m", "16", "-s", "fused"], None, 1),
+    ("Driver egm",              "RBC_CPP_Driver.cpp",  [], ["-e", "egm"], "0.146551", 1),
+    ("Driver spline",           "RBC_CPP_Driver.cpp",  [], ["-e", "spline"], "0.146551", 1),
+    ("Threads",                 "RBC_CPP_Threads.cpp", [], [], None, 0),
+    ("Threads n",               "RBC_CPP_Threads.cpp", [], ["{threads}"], None, 0),
+]
+
+# The reference policy is that of the default driver
+REFERENCE = VARIANTS[4]
+
+CHECK = re.compile(r"My check = ([-+0-9.eE]+)")
+ITERATION = re.compile(r"Iteration = (\d+)")
+CHECKSUM = re.compile(r"Policy checksum = ([0-9a-f]+)")
+
+# SolutionFileHeader of RBC_CPP_Solution.hpp, in the byte order of this machine
+SOLUTION_HEADER = struct.Struct("=8sIIiiiidddQ6QQQ")
+
+
+def percentile(values, fraction):
+    """Nearest-rank percentile of a list of numbers."""
+    ordered = sorted(values)
+    return ordered[max(0, int(math.ceil(fraction * len(ordered))) - 1)]
+
+
+def read_policy_index(fileName):
+    """Returns the policy indices of a solution file, capital-major as in the file."""
+    with open(fileName, "rb") as solution:
+        data = solution.read()
+    header = SOLUTION_HEADER.unpack_from(data)
+    if header[0] != b"RBCSOL01":
+        raise ValueError("%s is not a solution file" % fileName)
+    nGridCapital, nGridProductivity, policyIndexOffset = header[3], header[4], header[16]
+    policyIndex = array.array("i")
+    policyIndex.frombytes(data[policyIndexOffset:policyIndexOffset + 4 * nGridCapital * nGridProductivity])
+    return policyIndex
+
+
+def policy_checksum(policyIndex):
+    """FNV-1a hash of the bytes of the policy indices, as Solution::policy_checksum."""
+    checksum = 14695981039346656037
+    for byte in policyIndex.tobytes():
+        checksum = ((checksum ^ byte) * 1099511628211) & 0xFFFFFFFFFFFFFFFF
+    return "%x" % checksum
+
+
+def compare_policies(policyIndex, reference):
+    """Returns the number of states whose policy index differs from the reference and the
+    largest difference in grid points."""
+    if len(policyIndex) != len(reference):
+        return len(reference), float("inf")
+    differences = [abs(index - referenceIndex) for index, referenceIndex in zip(policyIndex, reference)]
+    return sum(1 for difference in differences if difference), max(differences)
+
+
+def pin_set(first, count):
+    """Returns count CPUs this process may run on, from CPU first on, or None where the
+    affinity cannot be set. Fewer are returned if fewer are available."""
+    if not hasattr(os, "sched_getaffinity"):
+        return None
+    available = sorted(os.sched_getaffinity(0))
+    ordered = [cpu for cpu in available if cpu >= first] + [cpu for cpu in available if cpu < first]
+    return set(ordered[:count])
+
+
+def build(source, flags, directory, cc, cxx):
+    """Compiles source into directory and returns the path of the executable, or None if
+    the compiler rejects it (RBC_C.c needs a compiler that initializes variable-length arrays)."""
+    executable = os.path.join(directory, os.path.splitext(os.path.basename(source))[0])
+    if source.endswith(".c"):
+        command = [cc, "-O3", "-march=native", "-o", executable, source, "-lm"] + flags
+    else:
+        command = [cxx, "-O3", "-march=native", "-std=gnu++11", "-pthread", "-o", executable, source] + flags
+    if subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT).returncode != 0:
+        return None
+    return executable
+
+
+def run(command, cpus):
+    """Runs command pinned to cpus and returns its wall time and output. Raises
+    subprocess.CalledProcessError if it exits with a non-zero status, and another
+    subprocess.SubprocessError or OSError if it cannot be started."""
+    pin = (lambda: os.sched_setaffinity(0, cpus)) if cpus else None
+    start = time.perf_counter()
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            universal_newlines=True, preexec_fn=pin, check=True)
+    return time.perf_counter() - start, result.stdout
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Builds, times and checks the C and C++ versions")
+    parser.add_argument("--warmups", type=int, default=1)
+    parser.add_argument("--repetitions", type=int, default=5)
+    parser.add_argument("--cpu", type=int, default=0, help="first CPU to pin to")
+    parser.add_argument("--threads", type=int, default=1, help="threads (and CPUs) for the threaded variants")
+    parser.add_argument("--only", default="", help="run the variants whose name contains this")
+    parser.add_argument("--allow-missing", action="store_true",
+                        help="do not count variants that do not build as failures")
+    parser.add_argument("--build", default=os.path.join(tempfile.gettempdir(), "rbc_benchmark"),
+                        help="directory for the executables")
+    arguments = parser.parse_args()
+
+    here = os.path.dirname(os.path.abspath(__file__))
+    os.chdir(here)
+    os.makedirs(arguments.build, exist_ok=True)
+    cc, cxx = os.environ.get("CC", "gcc"), os.environ.get("CXX", "g++")
+
+    executables = {}
+    reference = None
+    referencePolicy = None
+    failures = 0
+    threadedCpus = pin_set(arguments.cpu, arguments.threads)
+    if threadedCpus is not None and len(threadedCpus) < arguments.threads:
+        print("Only %d CPUs available; the threaded variants share them" % len(threadedCpus))
+    print("%-23s %10s %10s %10s %14s %10s" % ("Variant", "Median s", "p95 s", "Iterations", "Iterations/s", "Check"))
+
+    def executable_of(source, flags):
+        # Each source is built once per run of the harness, so the timings are of the current tree
+        if (source, tuple(flags)) not in executables:
+            executables[(source, tuple(flags))] = build(source, flags, arguments.build, cc, cxx)
+        return executables[(source, tuple(flags))]
+
+    def solution_file(name):
+        return os.path.join(arguments.build, name.replace(" ", "_") + ".rbcsol")
+
+    for name, source, flags, variantArguments, expected, tolerance in VARIANTS:
+        if arguments.only not in name:
+            continue
+        executable = executable_of(source, flags)
+        if executable is None:
+            print("%-23s %s" % (name, "not built with " + (cc if source.endswith(".c") else cxx)))
+            failures += not arguments.allow_missing
+            continue
+        command = [executable] + [argument.format(threads=arguments.threads) for argument in variantArguments]
+        threaded = any("{threads}" in argument for argument in variantArguments)
+        cpus = pin_set(arguments.cpu, arguments.threads if threaded else 1)
+        # The drivers write their solution in one untimed run, before the warm-ups
+        writesSolution = tolerance is not None and source == REFERENCE[1]
+
+        times, output = [], ""
+        try:
+            if tolerance is not None and referencePolicy is None:
+                referenceExecutable = executable_of(REFERENCE[1], REFERENCE[2])
+                if referenceExecutable is None:
+                    raise OSError("the reference driver does not build")
+                run([referenceExecutable] + REFERENCE[3] + ["-x", solution_file(REFERENCE[0])], pin_set(arguments.cpu, 1))
+                referencePolicy = read_policy_index(solution_file(REFERENCE[0]))
+            if writesSolution:
+                run(command + ["-x", solution_file(name)], cpus)
+            for _ in range(arguments.warmups):
+                run(command, cpus)
+            for _ in range(max(1, arguments.repetitions)):
+                elapsed, output = run(command, cpus)
+                times.append(elapsed)
+        except subprocess.CalledProcessError as error:
+            print("%-23s FAILED (exit status %d)" % (name, error.returncode))
+            failures += 1
+            continue
+        except (subprocess.SubprocessError, OSError, ValueError) as error:
+            print("%-23s FAILED (%s)" % (name, error))
+            failures += 1
+            continue
+
+        checks = CHECK.findall(output)
+        iterations = ITERATION.findall(output)
+        check = checks[-1] if checks else "missing"
+        nIterations = int(iterations[-1]) if iterations else 0
+        median = statistics.median(times)
+        if expected is None and reference is None:
+            reference = check
+        target = reference if expected is None else expected
+        status = "" if check == target else "  MISMATCH (expected %s)" % target
+        failed = check != target
+        if writesSolution:
+            differing, largest = compare_policies(read_policy_index(solution_file(name)), referencePolicy)
+            if largest > tolerance:
+                status += "  POLICY MISMATCH (%d states differ, up to %s grid points)" % (differing, largest)
+                failed = True
+            elif differing:
+                status += "  (%d states within %d grid point)" % (differing, tolerance)
+        elif tolerance is not None:
+            checksums = CHECKSUM.findall(output)
+            if not checksums or checksums[-1] != policy_checksum(referencePolicy):
+                status += "  POLICY MISMATCH (checksum %s, expected %s)" % (checksums[-1] if checksums else "missing",
+                                                                         policy_checksum(referencePolicy))
+                failed = True
+        failures += failed
+        print("%-23s %10.4f %10.4f %10d %14.1f %10s%s" % (name, median, percentile(times, 0.95), nIterations,
+                                                          nIterations / median, check, status))
+
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
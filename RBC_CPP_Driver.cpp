@@ -0,0 +1,602 @@
+//============================================================================
+// Name        : RBC_CPP_Driver.cpp
+// Description : Basic RBC model with full depreciation, every option of RBC_CPP_Solver.hpp
+// Date        : July 21, 2013
+//============================================================================
+
+// AUXILIARY TIMER FUNCTIONS
+
+#include <iostream>
+#include <math.h>       // power
+#include <cmath>        // abs
+#include <cstdlib>      // atoi, atof
+#include <cstring>      // strcmp
+#include <fstream>      // productivity process file
+#include <chrono>       // wall time of a sweep and of each run
+#include "RBC_CPP_Solver.hpp"
+#include "RBC_CPP_Simulation.hpp"
+using namespace std;
+using namespace rbc;
+
+// The next few lines are just for counting time
+//  Windows
+#ifdef _WIN32
+#include <Windows.h>
+double get_cpu_time(){
+    FILETIME a,b,c,d;
+    if (GetProcessTimes(GetCurrentProcess(),&a,&b,&c,&d) != 0){
+        //  Returns total user time.
+        //  Can be tweaked to include kernel times as well.
+        return
+        (double)(d.dwLowDateTime |
+                 ((unsigned long long)d.dwHighDateTime << 32)) * 0.0000001;
+    }else{
+        //  Handle error
+        return 0;
+    }
+}
+//  Posix/Linux
+#else
+#include <ctime>        // time
+double get_cpu_time(){
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+#endif
+
+// Largest distance of a row sum from one in a transition matrix read from a file, which may
+// be rounded (the rows of the matrix of the paper, to four decimals, miss one by up to 1e-4),
+// and in one generated at run time, which only floating-point rounding may move
+const double fileTransitionError = 1e-3, generatedTransitionError = 1e-12;
+
+// Calibration read from a file: 0 < aalpha < 1, 0 < bbeta < 1, positive productivity and a
+// transition matrix with rows that sum to one. Says on cerr what is wrong with source.
+bool check_calibration(const Model& model, const string& source){
+  if (!(model.aalpha > 0.0 && model.aalpha < 1.0 && model.bbeta > 0.0 && model.bbeta < 1.0)){
+    cerr <<source<<" needs 0 < aalpha < 1 and 0 < bbeta < 1\n";
+    return false;
+  }
+  for (int nProductivity = 0; nProductivity < model.productivity_states(); ++nProductivity){
+    if (!(model.vProductivity[nProductivity] > 0.0 && model.vProductivity[nProductivity] < HUGE_VAL)){
+      cerr <<source<<" has a productivity value that is not positive\n";
+      return false;
+    }
+  }
+  if (!(model.transition_error() <= fileTransitionError)){
+    cerr <<"The transition matrix of "<<source<<" has an entry outside [0,1] or a row that does not sum to one\n";
+    return false;
+  }
+  return true;
+}
+
+// Parameter sweep: each line of calibrationFile has aalpha, bbeta and nGridProductivity,
+// followed by the productivity values and the transition matrix by rows when
+// nGridProductivity > 0 (0 keeps the process of model). Every calibration uses the capital
+// grid of model, built once and shared by all threads. resultsFile gets one line per
+// calibration: its number, aalpha, bbeta, iterations, sup diff, check and whether it was
+// warm-started.
+bool run_sweep(const Model& model, const Options& options, const char* calibrationFile, const char* resultsFile, int nThreads){
+
+  ifstream calibrationInput(calibrationFile);
+  const vector<double> vGridCapital = model.grid_capital();
+  vector<Model> models;
+  Model calibration = model;
+  calibration.vGridCapitalShared = &vGridCapital[0];
+  int nGridProductivity;
+
+  while (calibrationInput >> calibration.aalpha >> calibration.bbeta >> nGridProductivity){
+    calibration.vProductivity = model.vProductivity;
+    calibration.mTransition = model.mTransition;
+    if (nGridProductivity > 0){
+      calibration.vProductivity.resize(nGridProductivity);
+      calibration.mTransition.resize(nGridProductivity*nGridProductivity);
+      for (int n = 0; n < nGridProductivity+nGridProductivity*nGridProductivity; ++n){
+	double& entry = (n < nGridProductivity) ? calibration.vProductivity[n] : calibration.mTransition[n-nGridProductivity];
+	calibrationInput >> entry;
+      }
+    }
+    if (calibrationInput && !check_calibration(calibration,"Calibration "+to_string(models.size()+1)+" of "+calibrationFile)){
+      return false;
+    }
+    models.push_back(calibration);
+  }
+  if (models.empty() || (calibrationInput.fail() && !calibrationInput.eof())){
+    cerr <<"Cannot read the calibrations from "<<calibrationFile<<"\n";
+    return false;
+  }
+
+  const int nModels = models.size();
+  vector<int> vIterations(nModels);
+  vector<double> vSupDiff(nModels), vCheck(nModels);
+  vector<char> vWarm(nModels);
+
+  const chrono::steady_clock::time_point wall0 = chrono::steady_clock::now();
+  solve_sweep(models,options,nThreads,[&](int nModel, const Solution& solution, bool warm){
+    vIterations[nModel] = solution.iterations;
+    vSupDiff[nModel] = solution.supDiff;
+    vCheck[nModel] = solution.policy(min(999,solution.nGridCapital-1),solution.nGridProductivity/2);
+    vWarm[nModel] = warm;
+  });
+  const double wallTime = chrono::duration<double>(chrono::steady_clock::now()-wall0).count();
+
+  long iterations = 0;
+  int warmStarts = 0;
+  ofstream results;
+  if (resultsFile != NULL){
+    results.open(resultsFile);
+    results.precision(17);
+  }
+  for (int nModel = 0; nModel < nModels; ++nModel){
+    iterations += vIterations[nModel];
+    warmStarts += vWarm[nModel];
+    if (results.is_open()){
+      results <<nModel<<" "<<models[nModel].aalpha<<" "<<models[nModel].bbeta<<" "<<vIterations[nModel]<<" "
+	      <<vSupDiff[nModel]<<" "<<vCheck[nModel]<<" "<<(int)vWarm[nModel]<<"\n";
+    }
+  }
+
+  cout <<"Calibrations = "<<nModels<<", Threads = "<<nThreads<<", Warm starts = "<<warmStarts
+       <<", Iterations = "<<iterations<<", Wall time = "<<wallTime<<", Solves per second = "<<nModels/wallTime<<"\n";
+  cout <<" \n";
+  cout <<"My check = "<< vCheck[nModels-1]<<"\n";
+  cout <<" \n";
+
+  return true;
+}
+
+// Usage: RBC_CPP_Driver [-n nGridCapital] [-l lowerBound] [-u upperBound] [-p productivityFile]
+//                       [-d tauchen|rouwenhorst [-z nGridProductivity] [-q rho] [-v sigma]] [-k howardSteps ...]
+//                       [-a row|column ...] [-e scalar|vector|binary|egm|spline ...] [-s separate|fused ...]
+//                       [-c supnorm|bounds ...] [-m coarsening] [-g splinePoints] [-r utilityCacheMB] [-w calibrationFile [-o resultsFile] [-t nThreads]]
+//                       [-f|-F checkpointFile [-i checkpointInterval]] [-x solutionFile] [-j traceFile]
+//                       [-A nAgents [-T nPeriods] [-B nBurnIn] [-t nThreads] [-P pathFile]] [-D tolerance]
+//                       [-E densePoints]
+//   lowerBound and upperBound are fractions of steady state capital (default 0.5 and 1.5).
+//   Without -n or -u the original grid with a step of 0.00001 is used.
+//   productivityFile has nGridProductivity, the productivity values and the transition matrix by rows.
+//   It and every calibration of -w are checked with check_calibration, the -d process as generated.
+//   With -d the productivity process is the discretization of log productivity
+//   z' = rho*z + sigma*e with nGridProductivity states (default 5, 0.95 and 0.007).
+//   -e egm solves by the endogenous grid method instead, and -e spline with continuous choices on
+//   a grid of splinePoints (default 200) set by -g; when grid search also runs, the gap between
+//   the policies is printed.
+//   With -m the solve starts on a grid about coarsening times coarser, of at least 128 points, and doubles
+//   it up to nGridCapital.
+//   With -r the period return of up to four choices around the policy is cached in utilityCacheMB MB once the policy settles.
+//   With -f the state of the solve is saved in checkpointFile every checkpointInterval iterations
+//   (default 50); -F also resumes from it when it holds a checkpoint of the same model.
+//   With -x the solution of the last run is written to solutionFile (see RBC_CPP_Solution.hpp).
+//   With -j each iteration is traced to traceFile as a JSON line (compile with -DRBC_INSTRUMENT).
+//   With -A nAgents agents are simulated for nPeriods periods (default 10000) from the
+//   solution of the last run on nThreads threads, and the moments after nBurnIn periods
+//   (default 1000, fewer than nPeriods) printed (see RBC_CPP_Simulation.hpp); -P writes the
+//   path of the first agent.
+//   With -D the stationary distribution of the last solution is found on nThreads threads, to an
+//   L1 distance of tolerance between iterates, and its moments printed.
+//   With -E the Euler equation errors of each run are computed on nThreads threads, on the grid
+//   and on densePoints capital points between grid points, and printed (log10 units).
+//   With -w the calibrations of calibrationFile are solved on nThreads threads (see run_sweep),
+//   with the first setting given for each option.
+// The solver is in RBC_CPP_Solver.hpp; see Options there for what each setting does. Each
+// combination of convergence rule, sweep, layout, engine and howardSteps given in the
+// command line is solved in turn, reusing the solver's memory.
+int main(int argc, char* argv[]) {
+    
+   double cpu0  = get_cpu_time();
+  
+  ///////////////////////////////////////////////////////////////////////////////////////////
+  // 1. Calibration
+  ///////////////////////////////////////////////////////////////////////////////////////////
+
+  Model model;
+  Options options;
+
+  const char* engineNames[5] = {"scalar", "vector", "binary", "egm", "spline"};
+  const int maxHowardRuns = 16, maxRuns = 40*maxHowardRuns;
+  int vHowardSteps[maxHowardRuns] = {1};
+  bool vColumnLayout[2] = {false}, vFusedSweep[2] = {false}, vBoundsConvergence[2] = {false};
+  int vEngine[5] = {scalarEngine};
+  int nHowardRuns = 0, nLayoutRuns = 0, nEngineRuns = 0, nSweepRuns = 0, nConvergenceRuns = 0;
+
+  const char* productivityFile = NULL;
+  const char* discretization = NULL;
+  int nGridProductivity = 5;
+  double rho = 0.95, sigma = 0.007;
+  const char* calibrationFile = NULL;
+  const char* resultsFile = NULL;
+  const char* solutionFile = NULL;
+  const char* traceFile = NULL;
+  int nThreads = 1;
+  SimulationOptions simulation;
+  simulation.nAgents = 0;
+  const char* pathFile = NULL;
+  DistributionOptions distributionOptions;
+  bool findDistribution = false;
+  EulerErrorOptions eulerOptions;
+  bool findEulerErrors = false;
+
+  for (int nArgument = 1; nArgument+1 < argc; nArgument += 2){
+    if (strcmp(argv[nArgument],"-n") == 0){
+      model.nGridCapital = atoi(argv[nArgument+1]);
+      model.defaultGrid = false;
+    }
+    else if (strcmp(argv[nArgument],"-l") == 0){
+      model.lowerBound = atof(argv[nArgument+1]);
+    }
+    else if (strcmp(argv[nArgument],"-u") == 0){
+      model.upperBound = atof(argv[nArgument+1]);
+      model.defaultGrid = false;
+    }
+    else if (strcmp(argv[nArgument],"-p") == 0){
+      productivityFile = argv[nArgument+1];
+    }
+    else if (strcmp(argv[nArgument],"-d") == 0){
+      discretization = argv[nArgument+1];
+    }
+    else if (strcmp(argv[nArgument],"-z") == 0){
+      nGridProductivity = max(atoi(argv[nArgument+1]),1);
+    }
+    else if (strcmp(argv[nArgument],"-q") == 0){
+      rho = atof(argv[nArgument+1]);
+    }
+    else if (strcmp(argv[nArgument],"-v") == 0){
+      sigma = atof(argv[nArgument+1]);
+    }
+    else if (strcmp(argv[nArgument],"-k") == 0 && nHowardRuns < maxHowardRuns){
+      vHowardSteps[nHowardRuns++] = atoi(argv[nArgument+1]) > 1 ? atoi(argv[nArgument+1]) : 1;
+    }
+    else if (strcmp(argv[nArgument],"-a") == 0 && nLayoutRuns < 2){
+      vColumnLayout[nLayoutRuns++] = strcmp(argv[nArgument+1],"column") == 0;
+    }
+    else if (strcmp(argv[nArgument],"-e") == 0 && nEngineRuns < 5){
+      vEngine[nEngineRuns] = scalarEngine;
+      for (int nEngine = 0; nEngine < 5; ++nEngine){
+	if (strcmp(argv[nArgument+1],engineNames[nEngine]) == 0){
+	  vEngine[nEngineRuns] = nEngine;
+	}
+      }
+      ++nEngineRuns;
+    }
+    else if (strcmp(argv[nArgument],"-m") == 0){
+      options.coarsening = max(atoi(argv[nArgument+1]),1);
+    }
+    else if (strcmp(argv[nArgument],"-s") == 0 && nSweepRuns < 2){
+      vFusedSweep[nSweepRuns++] = strcmp(argv[nArgument+1],"fused") == 0;
+    }
+    else if (strcmp(argv[nArgument],"-g") == 0){
+      options.splineGridPoints = max(atoi(argv[nArgument+1]),3);
+    }
+    else if (strcmp(argv[nArgument],"-r") == 0){
+      options.utilityCacheMB = atof(argv[nArgument+1]);
+    }
+    else if (strcmp(argv[nArgument],"-f") == 0 || strcmp(argv[nArgument],"-F") == 0){
+      options.checkpointFile = argv[nArgument+1];
+      options.resume = strcmp(argv[nArgument],"-F") == 0;
+    }
+    else if (strcmp(argv[nArgument],"-j") == 0){
+      traceFile = argv[nArgument+1];
+    }
+    else if (strcmp(argv[nArgument],"-x") == 0){
+      solutionFile = argv[nArgument+1];
+    }
+    else if (strcmp(argv[nArgument],"-i") == 0){
+      options.checkpointInterval = max(atoi(argv[nArgument+1]),1);
+    }
+    else if (strcmp(argv[nArgument],"-w") == 0){
+      calibrationFile = argv[nArgument+1];
+    }
+    else if (strcmp(argv[nArgument],"-o") == 0){
+      resultsFile = argv[nArgument+1];
+    }
+    else if (strcmp(argv[nArgument],"-t") == 0){
+      nThreads = max(atoi(argv[nArgument+1]),1);
+    }
+    else if (strcmp(argv[nArgument],"-A") == 0){
+      simulation.nAgents = max(atol(argv[nArgument+1]),0L);
+    }
+    else if (strcmp(argv[nArgument],"-T") == 0){
+      simulation.nPeriods = max(atol(argv[nArgument+1]),1L);
+    }
+    else if (strcmp(argv[nArgument],"-B") == 0){
+      simulation.nBurnIn = max(atol(argv[nArgument+1]),0L);
+    }
+    else if (strcmp(argv[nArgument],"-D") == 0){
+      distributionOptions.tolerance = atof(argv[nArgument+1]);
+      findDistribution = true;
+    }
+    else if (strcmp(argv[nArgument],"-E") == 0){
+      eulerOptions.densePoints = max(atoi(argv[nArgument+1]),0);
+      findEulerErrors = true;
+    }
+    else if (strcmp(argv[nArgument],"-P") == 0){
+      pathFile = argv[nArgument+1];
+    }
+    else if (strcmp(argv[nArgument],"-c") == 0 && nConvergenceRuns < 2){
+      vBoundsConvergence[nConvergenceRuns++] = strcmp(argv[nArgument+1],"bounds") == 0;
+    }
+    else{
+      cerr <<"Unknown option "<<argv[nArgument]<<"\n";
+      return 1;
+    }
+  }
+  nHowardRuns = max(nHowardRuns,1);
+  nLayoutRuns = max(nLayoutRuns,1);
+  nEngineRuns = max(nEngineRuns,1);
+  nSweepRuns = max(nSweepRuns,1);
+  nConvergenceRuns = max(nConvergenceRuns,1);
+  const int nSettingRuns = nHowardRuns*nEngineRuns*nLayoutRuns*nSweepRuns;
+  const int nRuns = nSettingRuns*nConvergenceRuns;
+#ifndef RBC_SIMD
+  if (vEngine[0] == vectorEngine || vEngine[1] == vectorEngine || vEngine[2] == vectorEngine || vEngine[3] == vectorEngine ||
+      vEngine[4] == vectorEngine){
+    cerr <<"No SIMD instruction set available, the vector engine runs the scalar walk\n";
+  }
+#endif
+#ifndef RBC_INSTRUMENT
+  if (traceFile != NULL){
+    cerr <<"Compiled without RBC_INSTRUMENT, "<<traceFile<<" stays empty\n";
+  }
+#endif
+  if (model.nGridCapital < 2){
+    cerr <<"The capital grid needs at least two points\n";
+    return 1;
+  }
+  if (simulation.nAgents > 0 && simulation.nPeriods <= simulation.nBurnIn){
+    cerr <<"The simulation needs more periods than burn-in periods ("<<simulation.nPeriods<<" periods, "
+	 <<simulation.nBurnIn<<" burn-in)\n";
+    return 1;
+  }
+
+  // Productivity values and transition matrix
+
+  if (productivityFile != NULL){
+    ifstream productivityInput(productivityFile);
+    if (!model.read_productivity(productivityInput)){
+      cerr <<"Cannot read the productivity process from "<<productivityFile<<"\n";
+      return 1;
+    }
+    if (!check_calibration(model,productivityFile)){
+      return 1;
+    }
+  }
+  if (discretization != NULL){
+    // The rows are checked as generated, before they are normalized
+    double transitionError;
+    if (!(rho > -1.0 && rho < 1.0 && sigma > 0.0)){
+      cerr <<"The discretization needs -1 < rho < 1 and sigma > 0\n";
+      return 1;
+    }
+    if (strcmp(discretization,"tauchen") == 0){
+      transitionError = model.tauchen(nGridProductivity,rho,sigma);
+    }
+    else if (strcmp(discretization,"rouwenhorst") == 0){
+      transitionError = model.rouwenhorst(nGridProductivity,rho,sigma);
+    }
+    else{
+      cerr <<"Unknown discretization "<<discretization<<"\n";
+      return 1;
+    }
+    if (!(transitionError <= generatedTransitionError)){
+      cerr <<"The "<<discretization<<" transition matrix has an entry outside [0,1] or a row that misses one by "
+	   <<transitionError<<" before normalization\n";
+      return 1;
+    }
+  }
+
+  ///////////////////////////////////////////////////////////////////////////////////////////
+  // 2. Steady State
+  ///////////////////////////////////////////////////////////////////////////////////////////
+
+  double capitalSteadyState = model.capital_steady_state();
+  double outputSteadyState  = pow(capitalSteadyState,model.aalpha);
+  double consumptionSteadyState = outputSteadyState-capitalSteadyState;
+
+  cout <<"Output = "<<outputSteadyState<<", Capital = "<<capitalSteadyState<<", Consumption = "<<consumptionSteadyState<<"\n";
+  cout <<" ";
+
+  // 3. Main iteration
+
+  if (calibrationFile != NULL){
+    options.howardSteps = vHowardSteps[0];
+    options.engine = vEngine[0];
+    options.columnLayout = vColumnLayout[0];
+    options.fusedSweep = vFusedSweep[0];
+    options.boundsConvergence = vBoundsConvergence[0];
+    if (!run_sweep(model,options,calibrationFile,resultsFile,nThreads)){
+      return 1;
+    }
+    cout << "Elapsed time is   = " << get_cpu_time()-cpu0 << endl;
+    cout <<" \n";
+    return 0;
+  }
+
+  Solver solver;
+  ofstream trace;
+  if (traceFile != NULL){
+    trace.open(traceFile);
+    options.trace = &trace;
+  }
+
+  int vIterations[maxRuns], vMaximizations[maxRuns];
+  long vEvaluations[maxRuns];
+  double vBytesMoved[maxRuns], vSupDiff[maxRuns], vTime[maxRuns], vCheck[maxRuns];
+  double vCacheMB[maxRuns], vCacheHits[maxRuns], vCacheSpeedup[maxRuns];
+  EulerErrors vEulerErrors[maxRuns];
+  eulerOptions.nThreads = nThreads;
+  const char* eulerSets[2] = {"grid", "off-grid"};
+
+  // The policies of the last grid search and of the last run of each other engine, to compare them
+  vector<double> gridSearchPolicy, vEnginePolicy[5];
+
+  // The check is the policy at the 1000th capital point and the middle productivity state
+  const int nCapitalCheck = min(999,model.nGridCapital-1), nProductivityCheck = model.productivity_states()/2;
+
+  for (int nRun = 0; nRun < nRuns; ++nRun){
+
+    options.howardSteps = vHowardSteps[nRun%nHowardRuns];
+    options.engine = vEngine[nRun/nHowardRuns%nEngineRuns];
+    options.columnLayout = vColumnLayout[nRun/(nHowardRuns*nEngineRuns)%nLayoutRuns];
+    options.fusedSweep = vFusedSweep[nRun/(nHowardRuns*nEngineRuns*nLayoutRuns)%nSweepRuns];
+    options.boundsConvergence = vBoundsConvergence[nRun/nSettingRuns];
+    options.progress = (nRuns == 1) ? &cout : NULL;
+    const chrono::steady_clock::time_point wallRun = chrono::steady_clock::now();
+
+    const Solution* solved = NULL;
+    try{
+      solved = &solver.solve(model,options);
+      if (solutionFile != NULL && nRun == nRuns-1){
+	write_solution(solutionFile,model,*solved);
+      }
+    }
+    catch (const std::runtime_error& error){
+      cerr <<error.what()<<"\n";
+      return 1;
+    }
+    const Solution& solution = *solved;
+
+    vIterations[nRun] = solution.iterations;
+    vMaximizations[nRun] = solution.maximizations;
+    vEvaluations[nRun] = solution.evaluations;
+    vBytesMoved[nRun] = solution.bytesPerIteration;
+    vSupDiff[nRun] = solution.supDiff;
+    vTime[nRun] = chrono::duration<double>(chrono::steady_clock::now()-wallRun).count();
+    vCheck[nRun] = solution.policy(nCapitalCheck,nProductivityCheck);
+    vCacheMB[nRun] = solution.utilityCacheBytes/1048576.0;
+    vCacheHits[nRun] = (double)solution.cacheHits/solution.evaluations;
+    vCacheSpeedup[nRun] = (solution.cachedMaximizationTime > 0.0) ? solution.uncachedMaximizationTime/solution.cachedMaximizationTime : 0.0;
+    if (findEulerErrors){
+      vEulerErrors[nRun] = euler_errors(model,solution,eulerOptions);
+    }
+    (options.engine == egmEngine || options.engine == splineEngine ? vEnginePolicy[options.engine] : gridSearchPolicy) = solution.mPolicyFunction;
+
+    if (nRuns == 1){
+      cout <<"Iteration = "<<solution.iterations<<", Sup Diff = "<<solution.supDiff<<"\n";
+    }
+    if (nRuns == 1 && vCacheMB[nRun] > 0.0){
+      cout <<"Utility cache MB = "<<vCacheMB[nRun]<<", Choices per state = "<<solution.utilityCacheWidth<<", Hit rate = "<<vCacheHits[nRun]
+	   <<", Speedup per maximization = "<<vCacheSpeedup[nRun]<<"\n";
+    }
+    if (nRuns == 1 && findEulerErrors){
+      for (int nSet = 0; nSet < 2; ++nSet){
+	const EulerErrorSummary& summary = nSet ? vEulerErrors[nRun].dense : vEulerErrors[nRun].grid;
+	cout <<"Euler errors ("<<eulerSets[nSet]<<", "<<summary.states<<" states): Max = "<<summary.maxError<<", Mean = "<<summary.meanError
+	     <<", p50 = "<<summary.percentile50<<", p90 = "<<summary.percentile90<<", p99 = "<<summary.percentile99<<"\n";
+      }
+      cout <<"Euler error time = "<<vEulerErrors[nRun].seconds<<"\n";
+    }
+  }
+
+  if (nRuns > 1){
+    for (int nRun = 0; nRun < nRuns; ++nRun){
+      const int engine = vEngine[nRun/nHowardRuns%nEngineRuns];
+      const bool fusedSweep = vFusedSweep[nRun/(nHowardRuns*nEngineRuns*nLayoutRuns)%nSweepRuns];
+      cout <<"Convergence = "<<(vBoundsConvergence[nRun/nSettingRuns] ? "bounds" : "supnorm")
+	   <<", Sweep = "<<(fusedSweep ? "fused" : "separate")
+	   <<", Layout = "<<(vColumnLayout[nRun/(nHowardRuns*nEngineRuns)%nLayoutRuns] || engine == vectorEngine || fusedSweep ? "column" : "row")
+	   <<", Engine = "<<engineNames[engine]<<", Howard steps = "<<vHowardSteps[nRun%nHowardRuns]
+	   <<", Iterations = "<<vIterations[nRun]<<", Maximizations = "<<vMaximizations[nRun]
+	   <<", Evaluations per maximization = "<<vEvaluations[nRun]/vMaximizations[nRun]
+	   <<", MB per iteration = "<<vBytesMoved[nRun]/1e6
+	   <<", Sup Diff = "<<vSupDiff[nRun]<<", Check = "<<vCheck[nRun]<<", Wall time = "<<vTime[nRun];
+      if (vCacheMB[nRun] > 0.0){
+	cout <<", Utility cache MB = "<<vCacheMB[nRun]<<", Hit rate = "<<vCacheHits[nRun]
+	     <<", Speedup per maximization = "<<vCacheSpeedup[nRun];
+      }
+      if (findEulerErrors){
+	cout <<", Euler error max = "<<vEulerErrors[nRun].grid.maxError<<", mean = "<<vEulerErrors[nRun].grid.meanError
+	     <<", off-grid max = "<<vEulerErrors[nRun].dense.maxError<<", mean = "<<vEulerErrors[nRun].dense.meanError;
+      }
+      // Iterations saved by the bounds against the same settings with the sup norm rule
+      for (int nOtherRun = nRun%nSettingRuns; nOtherRun < nRuns; nOtherRun += nSettingRuns){
+	if (vBoundsConvergence[nRun/nSettingRuns] && !vBoundsConvergence[nOtherRun/nSettingRuns]){
+	  cout <<", Iterations saved = "<<vIterations[nOtherRun]-vIterations[nRun];
+	  break;
+	}
+      }
+      cout <<"\n";
+    }
+  }
+
+  // The EGM and spline policies against grid search, also in grid steps, the resolution of grid search
+  for (int engine = egmEngine; engine <= splineEngine && !gridSearchPolicy.empty(); ++engine){
+    const vector<double>& policy = vEnginePolicy[engine];
+    if (policy.empty()){
+      continue;
+    }
+    double maxGap = 0.0, meanGap = 0.0;
+    for (size_t nState = 0; nState < policy.size(); ++nState){
+      maxGap = max(maxGap,std::abs(policy[nState]-gridSearchPolicy[nState]));
+      meanGap += std::abs(policy[nState]-gridSearchPolicy[nState])/policy.size();
+    }
+    cout <<(engine == egmEngine ? "EGM" : "Spline")<<" policy against grid search: Max gap = "<<maxGap<<", Mean gap = "<<meanGap
+	 <<", Max gap in grid steps = "<<maxGap/model.grid_step()<<"\n";
+  }
+
+  // 4. Simulation and stationary distribution from the last solution
+
+  const Solution& solution = solver.solution();
+  SimulationInput input;
+  input.nGridCapital = model.nGridCapital;
+  input.nGridProductivity = model.productivity_states();
+  input.aalpha = model.aalpha;
+  input.vGridCapital = &solution.vGridCapital[0];
+  input.vProductivity = &model.vProductivity[0];
+  input.mTransition = &model.mTransition[0];
+  input.mPolicyIndex = &solution.mPolicyIndex[0];
+  input.mPolicyFunction = &solution.mPolicyFunction[0];
+  const char* seriesNames[nSimulatedSeries] = {"Capital", "Output", "Consumption"};
+
+  if (simulation.nAgents > 0){
+    simulation.nThreads = nThreads;
+    const SimulationMoments moments = simulate(input,simulation);
+    cout <<" \n";
+    cout <<"Agents = "<<simulation.nAgents<<", Periods = "<<simulation.nPeriods<<", Burn-in = "<<simulation.nBurnIn
+	 <<", Threads = "<<nThreads<<", Periods per second = "<<simulation.nAgents*(double)simulation.nPeriods/moments.seconds<<"\n";
+    for (int series = 0; series < nSimulatedSeries; ++series){
+      cout <<seriesNames[series]<<": Mean = "<<moments.mean[series]<<", Standard deviation = "<<moments.standardDeviation[series]
+	   <<", Autocorrelation = "<<moments.autocorrelation[series]<<"\n";
+    }
+    cout <<"Correlation of output and consumption = "<<moments.outputConsumptionCorrelation<<"\n";
+
+    if (pathFile != NULL){
+      vector<int> capitalPath, productivityPath;
+      simulate_path(input,simulation,0,capitalPath,productivityPath);
+      ofstream path(pathFile);
+      path <<"period,capital,output,consumption,productivity\n";
+      for (long period = 0; period < simulation.nPeriods; ++period){
+	const int nCapital = capitalPath[period], nProductivity = productivityPath[period];
+	const double output = model.vProductivity[nProductivity]*pow(input.vGridCapital[nCapital],model.aalpha);
+	path <<period<<","<<input.vGridCapital[nCapital]<<","<<output<<","
+	     <<output-solution.policy(nCapital,nProductivity)<<","<<model.vProductivity[nProductivity]<<"\n";
+      }
+    }
+  }
+
+  if (findDistribution){
+    distributionOptions.nThreads = nThreads;
+    Distribution distribution;
+    stationary_distribution(input,distributionOptions,distribution);
+    const SimulationMoments& moments = distribution.moments;
+    cout <<" \n";
+    cout <<"Distribution iterations = "<<distribution.iterations<<", L1 distance = "<<distribution.distance
+	 <<", Threads = "<<distributionOptions.nThreads<<", Time = "<<distribution.seconds<<"\n";
+    for (int series = 0; series < nSimulatedSeries; ++series){
+      cout <<seriesNames[series]<<": Mean = "<<moments.mean[series]<<", Standard deviation = "<<moments.standardDeviation[series]
+	   <<", Autocorrelation = "<<moments.autocorrelation[series]<<"\n";
+    }
+    cout <<"Correlation of output and consumption = "<<moments.outputConsumptionCorrelation<<"\n";
+  }
+
+  cout <<" \n";
+  cout <<"My check = "<< vCheck[nRuns-1]<<"\n";
+  cout <<"Policy checksum = "<<hex<<solution.policy_checksum()<<dec<<"\n";
+  cout <<" \n";
+  
+  double cpu1  = get_cpu_time();
+
+  cout << "Elapsed time is   = " << cpu1  - cpu0  << endl;
+    
+  cout <<" \n";  
+
+  return 0;
+
+}
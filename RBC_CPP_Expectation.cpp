@@ -0,0 +1,113 @@
+//============================================================================
+// Name        : RBC_CPP_Expectation.cpp
+// Description : Benchmark of the kernels of the expectation operator of RBC_CPP_Solver.hpp
+//               across numbers of productivity states and transition matrix structures
+//============================================================================
+
+#include <algorithm>    // std::min
+#include <chrono>       // time measurement
+#include <cstdlib>      // std::atoi
+#include <iostream>
+#include <vector>
+
+#include "RBC_CPP_Solver.hpp"
+
+// Usage: RBC_CPP_Expectation [nGridCapital [nRepetitions]]
+// For 5, 15, 25 and 51 productivity states, builds a tridiagonal, a pentadiagonal, a sparse
+// (three nonzeros per row, spread over the row) and a dense transition matrix, and times the
+// expected value step of one iteration with each kernel, in the row and the column layout.
+// Chosen is the kernel the solver picks for that matrix.
+int main(int argc, char* argv[])
+{
+	const int nGridCapital = (argc > 1) ? std::max(1, std::atoi(argv[1])) : 17820;
+	const int nRepetitions = (argc > 2) ? std::max(1, std::atoi(argv[2])) : 50;
+
+	const char* kernelNames[3] = {"dense", "banded", "sparse"};
+	const char* matrixNames[4] = {"tridiagonal", "pentadiagonal", "sparse", "dense"};
+	const int vStates[4] = {5, 15, 25, 51};
+
+	double check = 0.0;
+
+	for (int nStates : vStates)
+	{
+		const std::size_t nPaddedCapital = (nGridCapital + 15) / 8 * 8;
+		std::vector<double> mValueFunction(nPaddedCapital * nStates), mExpected(nPaddedCapital * nStates);
+		for (std::size_t nState = 0; nState < mValueFunction.size(); ++nState)
+		{
+			mValueFunction[nState] = -1.0 + 1e-6 * (nState % 1013);
+		}
+
+		for (int nMatrix = 0; nMatrix < 4; ++nMatrix)
+		{
+			// Rows sum to one over their nonzeros
+			std::vector<double> mTransition(nStates * nStates, 0.0);
+			for (int nProductivity = 0; nProductivity < nStates; ++nProductivity)
+			{
+				std::vector<int> vColumns;
+				for (int nProductivityNextPeriod = 0; nProductivityNextPeriod < nStates; ++nProductivityNextPeriod)
+				{
+					const int distance = std::abs(nProductivityNextPeriod - nProductivity);
+					if ((nMatrix == 0 && distance <= 1) || (nMatrix == 1 && distance <= 2) || nMatrix == 3 ||
+						(nMatrix == 2 && (distance == 0 || nProductivityNextPeriod == (nProductivity + nStates / 3) % nStates ||
+										  nProductivityNextPeriod == (nProductivity + 2 * nStates / 3) % nStates)))
+					{
+						vColumns.push_back(nProductivityNextPeriod);
+					}
+				}
+				for (int nColumn : vColumns)
+				{
+					mTransition[nProductivity * nStates + nColumn] = 1.0 / vColumns.size();
+				}
+			}
+
+			rbc::ExpectationOperator expectation;
+			expectation.build(&mTransition[0], nStates);
+			const int chosen = expectation.kernel;
+
+			for (int columnLayout = 0; columnLayout < 2; ++columnLayout)
+			{
+				const std::size_t capitalStride = columnLayout ? 1 : nStates;
+				const std::size_t productivityStride = columnLayout ? nPaddedCapital : 1;
+
+				std::cout << "States = " << nStates << ", Matrix = " << matrixNames[nMatrix] << ", Chosen = " << kernelNames[chosen]
+						  << ", Layout = " << (columnLayout ? "column" : "row");
+
+				for (int kernel = 0; kernel < 3; ++kernel)
+				{
+					expectation.build(&mTransition[0], nStates, kernel);
+
+					const auto time_0 = std::chrono::steady_clock::now();
+					for (int nRepetition = 0; nRepetition < nRepetitions; ++nRepetition)
+					{
+						for (int nProductivity = 0; nProductivity < nStates; ++nProductivity)
+						{
+							if (columnLayout)
+							{
+								rbc::expected_column(&mExpected[nProductivity * productivityStride], &mValueFunction[0], expectation,
+													 nProductivity, productivityStride, nGridCapital);
+							}
+							else
+							{
+								rbc::expected_rows(&mExpected[nProductivity], &mValueFunction[0], expectation, nProductivity,
+												   capitalStride, productivityStride, 0, nGridCapital);
+							}
+						}
+						// Keep the value function changing so that no repetition can be skipped
+						mValueFunction[nRepetition % nGridCapital] += mExpected[0] * 1e-12;
+					}
+					const auto time_1 = std::chrono::steady_clock::now();
+					check += mExpected[std::min<std::size_t>(999, nGridCapital - 1) * capitalStride];
+
+					std::cout << ", " << kernelNames[kernel] << " = "
+							  << std::chrono::duration<double, std::milli>(time_1 - time_0).count() / nRepetitions << " ms";
+				}
+				std::cout << "\n";
+			}
+		}
+	}
+
+	std::cout << " \n";
+	std::cout << "Check = " << check << "\n";
+
+	return 0;
+}
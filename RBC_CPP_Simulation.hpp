@@ -0,0 +1,674 @@
+//============================================================================
+// Name        : RBC_CPP_Simulation.hpp
+// Description : Simulation of panels of agents from a solved RBC model. Each agent draws
+//               its productivity from its own counter-based random stream, so panels are
+//               reproducible for any number of threads and any agent's path can be
+//               regenerated on its own; moments are accumulated while simulating, so the
+//               panel is never stored. Also the stationary distribution over the grid, by
+//               iterating the forward operator of the policy. Needs only RBC_CPP_Solution.hpp,
+//               so it runs from a solution file as well as from a rbc::Solution.
+//============================================================================
+
+#ifndef RBC_CPP_SIMULATION_HPP
+#define RBC_CPP_SIMULATION_HPP
+
+#include <math.h>       // pow, sqrt, fabs
+#include <cstdint>
+#include <algorithm>    // min, max
+#include <vector>
+#include <thread>       // link with -pthread
+#include <atomic>
+#include <mutex>        // barrier of the distribution threads
+#include <condition_variable>
+#include <chrono>       // wall time
+
+#include "RBC_CPP_Solution.hpp"
+
+namespace rbc {
+
+using std::min;
+using std::max;
+
+// What the simulation needs from a solution: the grid, the productivity process and the
+// policy as grid indices, element (nCapital,nProductivity) at nCapital*nGridProductivity+nProductivity.
+// The simulation and the stationary distribution also use the policy function, which may
+// lie between grid points; without it the policy is the grid point of each index.
+struct SimulationInput{
+  int nGridCapital, nGridProductivity;
+  double aalpha;
+  const double* vGridCapital;
+  const double* vProductivity;
+  const double* mTransition;        // By rows
+  const int* mPolicyIndex;
+  const double* mPolicyFunction;    // Or NULL
+
+  SimulationInput() : nGridCapital(0), nGridProductivity(0), aalpha(0.0), vGridCapital(NULL), vProductivity(NULL),
+		      mTransition(NULL), mPolicyIndex(NULL), mPolicyFunction(NULL) {}
+
+  explicit SimulationInput(const SolutionFile& file) :
+    nGridCapital(file.capital_points()), nGridProductivity(file.productivity_states()), aalpha(file.header().aalpha),
+    vGridCapital(file.grid_capital()), vProductivity(file.productivity()), mTransition(file.transition()),
+    mPolicyIndex(file.policy_index()), mPolicyFunction(file.policy_function()) {}
+};
+
+// Every agent starts at initialCapital (a grid index, or -1 for the middle of the grid) and
+// initialProductivity (-1 for the middle state), and the first nBurnIn periods are not
+// counted in the moments.
+struct SimulationOptions{
+  long nAgents;
+  long nPeriods;
+  long nBurnIn;
+  std::uint64_t seed;
+  int nThreads;
+  int initialCapital, initialProductivity;
+
+  SimulationOptions() : nAgents(1000), nPeriods(10000), nBurnIn(1000), seed(20130721), nThreads(1),
+			initialCapital(-1), initialProductivity(-1) {}
+};
+
+const int simulatedCapital = 0, simulatedOutput = 1, simulatedConsumption = 2, nSimulatedSeries = 3;
+
+// Moments of capital, output and consumption over every agent and counted period
+struct SimulationMoments{
+  long observations;
+  double mean[nSimulatedSeries];
+  double standardDeviation[nSimulatedSeries];
+  double autocorrelation[nSimulatedSeries];   // First order, within each agent
+  double outputConsumptionCorrelation;
+  double seconds;                             // Wall time of the simulation
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Random streams
+///////////////////////////////////////////////////////////////////////////////////////////
+
+// Philox4x32-10 (Salmon, Moraes, Dror and Shaw, 2011): 128 random bits from a 128-bit
+// counter and a 64-bit key. The key is (seed, agent) and the counter the period, so draw t
+// of agent a is the same wherever and whenever it is computed.
+struct Philox{
+  std::uint32_t word[4];
+};
+
+inline Philox philox(std::uint64_t key, std::uint64_t counter){
+  std::uint32_t x0 = (std::uint32_t)counter, x1 = (std::uint32_t)(counter >> 32), x2 = 0, x3 = 0;
+  std::uint32_t k0 = (std::uint32_t)key, k1 = (std::uint32_t)(key >> 32);
+  for (int round = 0; round < 10; ++round){
+    const std::uint64_t product0 = (std::uint64_t)0xD2511F53u*x0, product1 = (std::uint64_t)0xCD9E8D57u*x2;
+    const std::uint32_t y0 = (std::uint32_t)(product1 >> 32)^x1^k0, y2 = (std::uint32_t)(product0 >> 32)^x3^k1;
+    x1 = (std::uint32_t)product1;
+    x3 = (std::uint32_t)product0;
+    x0 = y0;
+    x2 = y2;
+    k0 += 0x9E3779B9u;
+    k1 += 0xBB67AE85u;
+  }
+  Philox result = {{x0, x1, x2, x3}};
+  return result;
+}
+
+inline std::uint64_t stream_key(std::uint64_t seed, long agent){
+  return seed*0x9E3779B97F4A7C15ULL+(std::uint64_t)agent;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Alias tables
+///////////////////////////////////////////////////////////////////////////////////////////
+
+// Walker's alias method, built by Vose's algorithm for each row of the transition matrix:
+// the next state is column j with probability probability[j], and alias[j] otherwise, where
+// j is uniform. A draw costs two table reads and no search, whatever the number of states.
+struct AliasTable{
+  std::vector<double> probability;  // By rows, like the transition matrix
+  std::vector<int> alias;
+
+  void build(const double* mTransition, int nGridProductivity){
+    probability.assign(nGridProductivity*nGridProductivity,1.0);
+    alias.resize(nGridProductivity*nGridProductivity);
+    std::vector<double> scaled(nGridProductivity);
+    std::vector<int> small, large;
+    for (int nFrom = 0; nFrom < nGridProductivity; ++nFrom){
+      double sum = 0.0;
+      for (int nTo = 0; nTo < nGridProductivity; ++nTo){
+	sum += mTransition[nFrom*nGridProductivity+nTo];
+      }
+      small.clear();
+      large.clear();
+      for (int nTo = 0; nTo < nGridProductivity; ++nTo){
+	scaled[nTo] = mTransition[nFrom*nGridProductivity+nTo]*nGridProductivity/sum;
+	alias[nFrom*nGridProductivity+nTo] = nTo;
+	(scaled[nTo] < 1.0 ? small : large).push_back(nTo);
+      }
+      while (!small.empty() && !large.empty()){
+	const int nSmall = small.back(), nLarge = large.back();
+	small.pop_back();
+	probability[nFrom*nGridProductivity+nSmall] = scaled[nSmall];
+	alias[nFrom*nGridProductivity+nSmall] = nLarge;
+	scaled[nLarge] -= 1.0-scaled[nSmall];
+	if (scaled[nLarge] < 1.0){
+	  large.pop_back();
+	  small.push_back(nLarge);
+	}
+      }
+      // What is left has probability one up to rounding
+    }
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Simulation
+///////////////////////////////////////////////////////////////////////////////////////////
+
+namespace simulation_detail {
+
+const int blockAgents = 64;
+
+// Shifted sums of one block of agents: for each series x, sums of x, x*x and x*x(-1), and
+// of output*consumption, all about the starting state so that the variances do not cancel
+struct Sums{
+  long observations, lagObservations;
+  double sum[nSimulatedSeries], sumSquares[nSimulatedSeries], sumLag[nSimulatedSeries], sumOutputConsumption;
+};
+
+struct Tables{
+  std::vector<double> output;       // Output of each state
+  std::vector<double> choice;       // Capital chosen in each state
+  std::vector<int> lotteryIndex;    // And its lottery, see policy_lottery
+  std::vector<double> lotteryWeight;
+  AliasTable alias;
+  double shift[nSimulatedSeries];
+  int initialCapital, initialProductivity;
+};
+
+// The lottery of the choice in state nState (by capital, like the input): the grid interval
+// [nLow,nLow+1] that holds the choice, clamped to the grid, and the weight of the upper
+// point, so that moving to nLow+1 with probability weight gives the choice as the expected
+// capital. Returns the choice. A choice on a grid point has weight 0, or 1 at the top of the grid.
+inline double policy_lottery(const SimulationInput& input, size_t nState, int& nLow, double& weight){
+  const double* vGridCapital = input.vGridCapital;
+  const double choice = (input.mPolicyFunction != NULL) ? input.mPolicyFunction[nState] : vGridCapital[input.mPolicyIndex[nState]];
+  // The policy index is the grid point of the choice or one next to it
+  nLow = min(input.mPolicyIndex[nState],input.nGridCapital-2);
+  while (nLow > 0 && vGridCapital[nLow] > choice){
+    --nLow;
+  }
+  while (nLow < input.nGridCapital-2 && vGridCapital[nLow+1] <= choice){
+    ++nLow;
+  }
+  weight = min(max((choice-vGridCapital[nLow])/(vGridCapital[nLow+1]-vGridCapital[nLow]),0.0),1.0);
+  return choice;
+}
+
+// Uniform on [0,1) from the second word, which next_productivity does not use, for the
+// capital lottery
+inline double lottery_uniform(const Philox& bits){
+  return bits.word[1]*(1.0/4294967296.0);
+}
+
+inline int next_productivity(const double* probability, const int* alias, int nGridProductivity, int nProductivity,
+			     const Philox& bits){
+  // Column from the first word by multiply and shift, and a 53-bit uniform from the last two
+  const int nColumn = (int)(((std::uint64_t)bits.word[0]*(std::uint64_t)nGridProductivity) >> 32);
+  const double uniform = (double)((((std::uint64_t)bits.word[2] << 32)|bits.word[3]) >> 11)*(1.0/9007199254740992.0);
+  const int nEntry = nProductivity*nGridProductivity+nColumn;
+  return (uniform < probability[nEntry]) ? nColumn : alias[nEntry];
+}
+
+// Simulates agents [nAgentBegin,nAgentEnd), at most blockAgents of them, one period at a
+// time across the block. The state of every agent is in small arrays and each period is two
+// loops over the agents, the draws and then the moments and the policy, with no dependence
+// between agents and no branch, so that the compiler vectorizes them with gathers from the tables.
+// Capital next period is drawn from the lottery of the choice, so a policy between grid
+// points gives the choice as expected capital, as in the stationary distribution.
+inline void simulate_block(const SimulationInput& input, const SimulationOptions& options, const Tables& tables,
+			   long nAgentBegin, long nAgentEnd, Sums& sums){
+  const int nGridProductivity = input.nGridProductivity;
+  const int nLanes = (int)(nAgentEnd-nAgentBegin);
+  const double* vGridCapital = input.vGridCapital;
+  const double* output = &tables.output[0];
+  const double* choice = &tables.choice[0];
+  const int* lotteryIndex = &tables.lotteryIndex[0];
+  const double* lotteryWeight = &tables.lotteryWeight[0];
+  const double* probability = &tables.alias.probability[0];
+  const int* alias = &tables.alias.alias[0];
+  const double capitalShift = tables.shift[simulatedCapital], outputShift = tables.shift[simulatedOutput];
+  const double consumptionShift = tables.shift[simulatedConsumption];
+
+  int capital[blockAgents], productivity[blockAgents], productivityNextPeriod[blockAgents];
+  double lottery[blockAgents];
+  std::uint64_t key[blockAgents];
+  double previous[nSimulatedSeries][blockAgents] = {{0.0}};
+  double sum[nSimulatedSeries][blockAgents] = {{0.0}}, sumSquares[nSimulatedSeries][blockAgents] = {{0.0}};
+  double sumLag[nSimulatedSeries][blockAgents] = {{0.0}}, sumOutputConsumption[blockAgents] = {0.0};
+
+  for (int lane = 0; lane < nLanes; ++lane){
+    capital[lane] = tables.initialCapital;
+    productivity[lane] = tables.initialProductivity;
+    key[lane] = stream_key(options.seed,nAgentBegin+lane);
+  }
+
+  for (long period = 0; period < options.nPeriods; ++period){
+    for (int lane = 0; lane < nLanes; ++lane){
+      const Philox bits = philox(key[lane],(std::uint64_t)period);
+      productivityNextPeriod[lane] = next_productivity(probability,alias,nGridProductivity,productivity[lane],bits);
+      lottery[lane] = lottery_uniform(bits);
+    }
+    // Weights rather than branches: nothing is counted in the burn-in, and the first counted
+    // period has no lag
+    const double weight = (period >= options.nBurnIn) ? 1.0 : 0.0, lagWeight = (period > options.nBurnIn) ? 1.0 : 0.0;
+    for (int lane = 0; lane < nLanes; ++lane){
+      const int nState = capital[lane]*nGridProductivity+productivity[lane];
+      const int nCapitalNextPeriod = lotteryIndex[nState]+(lottery[lane] < lotteryWeight[nState]);
+      const double k = vGridCapital[capital[lane]]-capitalShift;
+      const double y = output[nState]-outputShift;
+      const double c = output[nState]-choice[nState]-consumptionShift;
+      sum[simulatedCapital][lane] += weight*k;
+      sum[simulatedOutput][lane] += weight*y;
+      sum[simulatedConsumption][lane] += weight*c;
+      sumSquares[simulatedCapital][lane] += weight*k*k;
+      sumSquares[simulatedOutput][lane] += weight*y*y;
+      sumSquares[simulatedConsumption][lane] += weight*c*c;
+      sumLag[simulatedCapital][lane] += lagWeight*k*previous[simulatedCapital][lane];
+      sumLag[simulatedOutput][lane] += lagWeight*y*previous[simulatedOutput][lane];
+      sumLag[simulatedConsumption][lane] += lagWeight*c*previous[simulatedConsumption][lane];
+      sumOutputConsumption[lane] += weight*y*c;
+      previous[simulatedCapital][lane] = k;
+      previous[simulatedOutput][lane] = y;
+      previous[simulatedConsumption][lane] = c;
+      capital[lane] = nCapitalNextPeriod;
+      productivity[lane] = productivityNextPeriod[lane];
+    }
+  }
+
+  const long nCounted = max(options.nPeriods-options.nBurnIn,0L);
+  sums.observations = nCounted*nLanes;
+  sums.lagObservations = max(nCounted-1,0L)*nLanes;
+  sums.sumOutputConsumption = 0.0;
+  for (int series = 0; series < nSimulatedSeries; ++series){
+    sums.sum[series] = sums.sumSquares[series] = sums.sumLag[series] = 0.0;
+    for (int lane = 0; lane < nLanes; ++lane){
+      sums.sum[series] += sum[series][lane];
+      sums.sumSquares[series] += sumSquares[series][lane];
+      sums.sumLag[series] += sumLag[series][lane];
+    }
+  }
+  for (int lane = 0; lane < nLanes; ++lane){
+    sums.sumOutputConsumption += sumOutputConsumption[lane];
+  }
+}
+
+inline void build_tables(const SimulationInput& input, const SimulationOptions& options, Tables& tables){
+  const int nGridCapital = input.nGridCapital, nGridProductivity = input.nGridProductivity;
+  const size_t nStates = (size_t)nGridCapital*nGridProductivity;
+  tables.output.resize(nStates);
+  tables.choice.resize(nStates);
+  tables.lotteryIndex.resize(nStates);
+  tables.lotteryWeight.resize(nStates);
+  for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+    for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+      const size_t nState = (size_t)nCapital*nGridProductivity+nProductivity;
+      tables.output[nState] = input.vProductivity[nProductivity]*pow(input.vGridCapital[nCapital],input.aalpha);
+      tables.choice[nState] = policy_lottery(input,nState,tables.lotteryIndex[nState],tables.lotteryWeight[nState]);
+    }
+  }
+  tables.alias.build(input.mTransition,nGridProductivity);
+  tables.initialCapital = (options.initialCapital >= 0) ? min(options.initialCapital,nGridCapital-1) : nGridCapital/2;
+  tables.initialProductivity = (options.initialProductivity >= 0) ? min(options.initialProductivity,nGridProductivity-1) : nGridProductivity/2;
+  const int nState = tables.initialCapital*nGridProductivity+tables.initialProductivity;
+  tables.shift[simulatedCapital] = input.vGridCapital[tables.initialCapital];
+  tables.shift[simulatedOutput] = tables.output[nState];
+  tables.shift[simulatedConsumption] = tables.output[nState]-tables.choice[nState];
+}
+
+} // namespace simulation_detail
+
+// Simulates options.nAgents agents for options.nPeriods periods on options.nThreads threads.
+// Blocks of agents are taken from a shared counter, each block keeps its sums in its own
+// slot, and the slots are added in block order once every block is done.
+inline SimulationMoments simulate(const SimulationInput& input, const SimulationOptions& options){
+  using namespace simulation_detail;
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  Tables tables;
+  build_tables(input,options,tables);
+
+  const long nBlocks = (options.nAgents+blockAgents-1)/blockAgents;
+  std::vector<Sums> blockSums(nBlocks);
+  std::atomic<long> nextBlock(0);
+  const auto worker = [&](){
+    for (long nBlock = nextBlock++; nBlock < nBlocks; nBlock = nextBlock++){
+      simulate_block(input,options,tables,nBlock*blockAgents,min((nBlock+1)*blockAgents,options.nAgents),blockSums[nBlock]);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int nThread = 1; nThread < options.nThreads; ++nThread){
+    workers.push_back(std::thread(worker));
+  }
+  worker();
+  for (size_t nThread = 0; nThread < workers.size(); ++nThread){
+    workers[nThread].join();
+  }
+
+  Sums total = {0, 0, {0.0}, {0.0}, {0.0}, 0.0};
+  for (long nBlock = 0; nBlock < nBlocks; ++nBlock){
+    total.observations += blockSums[nBlock].observations;
+    total.lagObservations += blockSums[nBlock].lagObservations;
+    total.sumOutputConsumption += blockSums[nBlock].sumOutputConsumption;
+    for (int series = 0; series < nSimulatedSeries; ++series){
+      total.sum[series] += blockSums[nBlock].sum[series];
+      total.sumSquares[series] += blockSums[nBlock].sumSquares[series];
+      total.sumLag[series] += blockSums[nBlock].sumLag[series];
+    }
+  }
+
+  // Moments of the shifted series; the lag products use the overall mean for both terms
+  SimulationMoments moments;
+  const double n = (double)max(total.observations,1L), nLag = (double)max(total.lagObservations,1L);
+  double shiftedMean[nSimulatedSeries], variance[nSimulatedSeries];
+  moments.observations = total.observations;
+  for (int series = 0; series < nSimulatedSeries; ++series){
+    shiftedMean[series] = total.sum[series]/n;
+    variance[series] = max(total.sumSquares[series]/n-shiftedMean[series]*shiftedMean[series],0.0);
+    moments.mean[series] = shiftedMean[series]+tables.shift[series];
+    moments.standardDeviation[series] = sqrt(variance[series]);
+    moments.autocorrelation[series] = (variance[series] > 0.0) ?
+      (total.sumLag[series]/nLag-shiftedMean[series]*shiftedMean[series])/variance[series] : 0.0;
+  }
+  const double covariance = total.sumOutputConsumption/n-shiftedMean[simulatedOutput]*shiftedMean[simulatedConsumption];
+  moments.outputConsumptionCorrelation = (variance[simulatedOutput] > 0.0 && variance[simulatedConsumption] > 0.0) ?
+    covariance/sqrt(variance[simulatedOutput]*variance[simulatedConsumption]) : 0.0;
+  moments.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  return moments;
+}
+
+// The path of one agent, the same as in simulate(): capital and productivity state indices
+// of periods 0 to nPeriods-1, including the burn-in
+inline void simulate_path(const SimulationInput& input, const SimulationOptions& options, long agent,
+			  std::vector<int>& capitalPath, std::vector<int>& productivityPath){
+  using namespace simulation_detail;
+  Tables tables;
+  build_tables(input,options,tables);
+  capitalPath.resize(options.nPeriods);
+  productivityPath.resize(options.nPeriods);
+  int capital = tables.initialCapital, productivity = tables.initialProductivity;
+  const std::uint64_t key = stream_key(options.seed,agent);
+  for (long period = 0; period < options.nPeriods; ++period){
+    capitalPath[period] = capital;
+    productivityPath[period] = productivity;
+    const size_t nState = (size_t)capital*input.nGridProductivity+productivity;
+    const Philox bits = philox(key,(std::uint64_t)period);
+    capital = tables.lotteryIndex[nState]+(lottery_uniform(bits) < tables.lotteryWeight[nState]);
+    productivity = next_productivity(&tables.alias.probability[0],&tables.alias.alias[0],input.nGridProductivity,productivity,bits);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Stationary distribution
+///////////////////////////////////////////////////////////////////////////////////////////
+
+struct DistributionOptions{
+  double tolerance;                 // On the L1 distance between two iterates
+  int maxIterations;
+  int nThreads;
+
+  DistributionOptions() : tolerance(1e-10), maxIterations(100000), nThreads(1) {}
+};
+
+// The stationary distribution stored by productivity state, like the column layout of the
+// solver: the mass of (nCapital,nProductivity) is at nProductivity*nGridCapital+nCapital
+struct Distribution{
+  int nGridCapital, nGridProductivity;
+  std::vector<double> mDistribution;
+  int iterations;
+  double distance;                  // L1 distance of the last iteration
+  double seconds;
+  SimulationMoments moments;        // Exact moments under the distribution; observations is 0
+
+  double mass(int nCapital, int nProductivity) const { return mDistribution[(size_t)nProductivity*nGridCapital+nCapital]; }
+};
+
+namespace simulation_detail {
+
+// Threads of the distribution wait here for each other: wait() returns once nThreads
+// threads have called it, and the barrier can be used again at once.
+class Barrier{
+public:
+  explicit Barrier(int nThreads) : nThreads(nThreads), nWaiting(0), generation(0) {}
+
+  void wait(){
+    std::unique_lock<std::mutex> lock(mutex);
+    const long arrived = generation;
+    if (++nWaiting == nThreads){
+      nWaiting = 0;
+      ++generation;
+      released.notify_all();
+      return;
+    }
+    released.wait(lock,[&](){ return generation != arrived; });
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable released;
+  int nThreads, nWaiting;
+  long generation;
+};
+
+// Mass of one productivity state next period, the state of one thread: the mass of each
+// state of the columns with mass, weighted by the probability of moving to nProductivity,
+// goes to the grid points lotteryIndex and lotteryIndex+1 of its choice, lotteryWeight of it
+// to the second. In a column whose choices are all grid points (onGrid) lotteryIndex is the
+// point and all the mass goes there, without reading the weight or a second store. Only
+// [support[2*n],support[2*n+1]] of column n has mass; on entry nextSupport is the support of
+// what next holds from two iterations before, which is cleared, and on return the support
+// of the result.
+inline double forward_column(const double* current, double* next, const int* lotteryIndex, const double* lotteryWeight,
+			     const int* onGrid, const double* mTransition, int nGridCapital, int nGridProductivity,
+			     const int* support, int* nextSupport, int nProductivity){
+  double* to = next+(size_t)nProductivity*nGridCapital;
+  const double* from = current+(size_t)nProductivity*nGridCapital;
+  int low = nGridCapital, high = -1;
+  if (nextSupport[2*nProductivity] <= nextSupport[2*nProductivity+1]){
+    std::fill(to+nextSupport[2*nProductivity],to+nextSupport[2*nProductivity+1]+1,0.0);
+  }
+  for (int nFrom = 0; nFrom < nGridProductivity; ++nFrom){
+    const double probability = mTransition[nFrom*nGridProductivity+nProductivity];
+    if (probability == 0.0 || support[2*nFrom] > support[2*nFrom+1]){
+      continue;
+    }
+    const int* index = lotteryIndex+(size_t)nFrom*nGridCapital;
+    const double* weight = lotteryWeight+(size_t)nFrom*nGridCapital;
+    const double* mass = current+(size_t)nFrom*nGridCapital;
+    if (onGrid[nFrom]){
+      for (int nCapital = support[2*nFrom]; nCapital <= support[2*nFrom+1]; ++nCapital){
+	to[index[nCapital]] += probability*mass[nCapital];
+	low = min(low,index[nCapital]);
+	high = max(high,index[nCapital]);
+      }
+      continue;
+    }
+    for (int nCapital = support[2*nFrom]; nCapital <= support[2*nFrom+1]; ++nCapital){
+      const double moved = probability*mass[nCapital], up = weight[nCapital]*moved;
+      to[index[nCapital]] += moved-up;
+      to[index[nCapital]+1] += up;
+      low = min(low,index[nCapital]);
+      high = max(high,index[nCapital]+1);
+    }
+  }
+  // The change is zero outside both supports
+  const int begin = min(low,support[2*nProductivity]), end = max(high,support[2*nProductivity+1]);
+  double distance = 0.0;
+  for (int nCapital = begin; nCapital <= end; ++nCapital){
+    distance += fabs(to[nCapital]-from[nCapital]);
+  }
+  nextSupport[2*nProductivity] = low;
+  nextSupport[2*nProductivity+1] = high;
+  return distance;
+}
+
+} // namespace simulation_detail
+
+// Stationary distribution of (capital, productivity) under the policy, by iterating the
+// forward operator on the grid (Young, 2010): the mass of a state whose choice lies between
+// two grid points is split between them in proportion to the distance to each, so the
+// expected capital next period is the choice. A policy on the grid points moves all the
+// mass to one of them. Starts from equal mass at the middle capital point in every
+// productivity state and stops when the L1 distance between two iterates is below
+// options.tolerance. The threads are started once; in each iteration they take the
+// productivity states from a shared counter and meet at a barrier before the next.
+inline void stationary_distribution(const SimulationInput& input, const DistributionOptions& options, Distribution& distribution){
+  using namespace simulation_detail;
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const int nGridCapital = input.nGridCapital, nGridProductivity = input.nGridProductivity;
+  const size_t nStates = (size_t)nGridCapital*nGridProductivity;
+  const double* vGridCapital = input.vGridCapital;
+
+  // The transition matrix with rows that sum to one, as the rows of the original calibration
+  // do only to four decimals; otherwise mass is created
+  std::vector<double> mTransition(input.mTransition,input.mTransition+nGridProductivity*nGridProductivity);
+  for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+    double rowSum = 0.0;
+    for (int nProductivityNextPeriod = 0; nProductivityNextPeriod < nGridProductivity; ++nProductivityNextPeriod){
+      rowSum += mTransition[nProductivity*nGridProductivity+nProductivityNextPeriod];
+    }
+    for (int nProductivityNextPeriod = 0; nProductivityNextPeriod < nGridProductivity; ++nProductivityNextPeriod){
+      mTransition[nProductivity*nGridProductivity+nProductivityNextPeriod] /= rowSum;
+    }
+  }
+
+  // Choice of each state by productivity state, and its lottery (policy_lottery). A column
+  // with every choice on a grid point keeps the point and weight 0.
+  std::vector<double> policyColumns(nStates), lotteryWeight(nStates);
+  std::vector<int> lotteryIndex(nStates);
+  std::vector<int> onGrid(nGridProductivity,1);
+  for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+    for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+      const size_t nState = (size_t)nCapital*nGridProductivity+nProductivity, nColumnState = (size_t)nProductivity*nGridCapital+nCapital;
+      policyColumns[nColumnState] = policy_lottery(input,nState,lotteryIndex[nColumnState],lotteryWeight[nColumnState]);
+      onGrid[nProductivity] &= (lotteryWeight[nColumnState] == 0.0 || lotteryWeight[nColumnState] == 1.0);
+    }
+  }
+  for (size_t nColumnState = 0; nColumnState < nStates; ++nColumnState){
+    if (onGrid[nColumnState/nGridCapital]){
+      lotteryIndex[nColumnState] += (int)lotteryWeight[nColumnState];
+      lotteryWeight[nColumnState] = 0.0;
+    }
+  }
+
+  std::vector<double>& current = distribution.mDistribution;
+  std::vector<double> next(nStates,0.0), distances(nGridProductivity);
+  std::vector<int> support(2*nGridProductivity), nextSupport(2*nGridProductivity);
+  current.assign(nStates,0.0);
+  for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+    current[(size_t)nProductivity*nGridCapital+nGridCapital/2] = 1.0/nGridProductivity;
+    support[2*nProductivity] = support[2*nProductivity+1] = nGridCapital/2;
+    nextSupport[2*nProductivity] = nGridCapital;
+    nextSupport[2*nProductivity+1] = -1;
+  }
+
+  const int nThreads = max(1,min(options.nThreads,nGridProductivity));
+  distribution.nGridCapital = nGridCapital;
+  distribution.nGridProductivity = nGridProductivity;
+  distribution.distance = 1.0;
+  distribution.iterations = 0;
+
+  // The calling thread runs the loop and takes part in every sweep; the others wait at the
+  // barrier for the next sweep, or for finished
+  std::atomic<int> nextProductivity(0);
+  Barrier barrier(nThreads);
+  bool finished = false;
+  const auto sweep = [&](){
+    for (int nProductivity = nextProductivity++; nProductivity < nGridProductivity; nProductivity = nextProductivity++){
+      distances[nProductivity] = forward_column(&current[0],&next[0],&lotteryIndex[0],&lotteryWeight[0],&onGrid[0],&mTransition[0],
+						nGridCapital,nGridProductivity,&support[0],&nextSupport[0],nProductivity);
+    }
+  };
+  const auto worker = [&](){
+    while (true){
+      barrier.wait();
+      if (finished){
+	return;
+      }
+      sweep();
+      barrier.wait();
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int nThread = 1; nThread < nThreads; ++nThread){
+    workers.push_back(std::thread(worker));
+  }
+
+  while (distribution.distance >= options.tolerance && distribution.iterations < options.maxIterations){
+    nextProductivity = 0;
+    barrier.wait();
+    sweep();
+    barrier.wait();
+    distribution.distance = 0.0;
+    for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+      distribution.distance += distances[nProductivity];
+    }
+    current.swap(next);
+    support.swap(nextSupport);
+    ++distribution.iterations;
+  }
+
+  finished = true;
+  barrier.wait();
+  for (size_t nThread = 0; nThread < workers.size(); ++nThread){
+    workers[nThread].join();
+  }
+
+  // Moments of capital, output and consumption, and the expected value of each next period
+  // given the state for the autocorrelations: next period is at either point of the lottery
+  const auto state_values = [&](int nCapital, int nProductivity, double* value){
+    const double output = input.vProductivity[nProductivity]*pow(vGridCapital[nCapital],input.aalpha);
+    value[simulatedCapital] = vGridCapital[nCapital];
+    value[simulatedOutput] = output;
+    value[simulatedConsumption] = output-policyColumns[(size_t)nProductivity*nGridCapital+nCapital];
+  };
+  double sum[nSimulatedSeries] = {0.0}, sumSquares[nSimulatedSeries] = {0.0}, sumLag[nSimulatedSeries] = {0.0};
+  double sumOutputConsumption = 0.0;
+  for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+    for (int nCapital = support[2*nProductivity]; nCapital <= support[2*nProductivity+1]; ++nCapital){
+      const size_t nColumnState = (size_t)nProductivity*nGridCapital+nCapital;
+      const double mass = current[nColumnState];
+      if (mass == 0.0){
+	continue;
+      }
+      const int nLow = lotteryIndex[nColumnState];
+      const double weight = lotteryWeight[nColumnState];
+      double value[nSimulatedSeries], expected[nSimulatedSeries] = {0.0}, valueLow[nSimulatedSeries], valueHigh[nSimulatedSeries];
+      state_values(nCapital,nProductivity,value);
+      for (int nProductivityNextPeriod = 0; nProductivityNextPeriod < nGridProductivity; ++nProductivityNextPeriod){
+	const double probability = mTransition[nProductivity*nGridProductivity+nProductivityNextPeriod];
+	state_values(nLow,nProductivityNextPeriod,valueLow);
+	state_values((weight > 0.0) ? nLow+1 : nLow,nProductivityNextPeriod,valueHigh);
+	for (int series = 0; series < nSimulatedSeries; ++series){
+	  expected[series] += probability*((1-weight)*valueLow[series]+weight*valueHigh[series]);
+	}
+      }
+      for (int series = 0; series < nSimulatedSeries; ++series){
+	sum[series] += mass*value[series];
+	sumSquares[series] += mass*value[series]*value[series];
+	sumLag[series] += mass*value[series]*expected[series];
+      }
+      sumOutputConsumption += mass*value[simulatedOutput]*value[simulatedConsumption];
+    }
+  }
+  SimulationMoments& moments = distribution.moments;
+  double variance[nSimulatedSeries];
+  moments.observations = 0;
+  for (int series = 0; series < nSimulatedSeries; ++series){
+    moments.mean[series] = sum[series];
+    variance[series] = max(sumSquares[series]-sum[series]*sum[series],0.0);
+    moments.standardDeviation[series] = sqrt(variance[series]);
+    moments.autocorrelation[series] = (variance[series] > 0.0) ? (sumLag[series]-sum[series]*sum[series])/variance[series] : 0.0;
+  }
+  moments.outputConsumptionCorrelation = (variance[simulatedOutput] > 0.0 && variance[simulatedConsumption] > 0.0) ?
+    (sumOutputConsumption-sum[simulatedOutput]*sum[simulatedConsumption])/sqrt(variance[simulatedOutput]*variance[simulatedConsumption]) : 0.0;
+  distribution.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+} // namespace rbc
+
+#endif
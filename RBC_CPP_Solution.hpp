@@ -0,0 +1,186 @@
+//============================================================================
+// Name        : RBC_CPP_Solution.hpp
+// Description : Binary solution file of the RBC model: format and a reader that maps the
+//               file into memory, so that simulation jobs read the value and policy
+//               functions without copying them. Files are written by rbc::write_solution
+//               in RBC_CPP_Solver.hpp; this header does not need the solver.
+//============================================================================
+
+#ifndef RBC_CPP_SOLUTION_HPP
+#define RBC_CPP_SOLUTION_HPP
+
+#include <cstdint>
+#include <cstdio>       // fopen, fread
+#include <cstdlib>      // malloc, free
+#include <cstring>      // memcmp
+
+#if defined(_WIN32)
+#define RBC_NO_MMAP
+#else
+#include <fcntl.h>      // open
+#include <sys/mman.h>   // mmap
+#include <sys/stat.h>   // fstat
+#include <unistd.h>     // close
+#endif
+
+namespace rbc {
+
+// A solution file is this 128-byte header followed by the arrays it points to, each at an
+// offset that is a multiple of 64 bytes: the capital grid, the productivity values and the
+// transition matrix by rows (doubles), and the value function, the policy function
+// (doubles) and the policy indices (int32) with element (nCapital,nProductivity) at
+// nCapital*nGridProductivity+nProductivity (layout 0). Numbers are in the byte order of the
+// writer; byteOrder lets a reader detect a file from a machine of the other order.
+struct SolutionFileHeader{
+  char magic[8];                    // "RBCSOL01"
+  std::uint32_t headerBytes;
+  std::uint32_t byteOrder;          // 0x01020304
+  std::int32_t nGridCapital, nGridProductivity;
+  std::int32_t layout;
+  std::int32_t iterations;
+  double aalpha, bbeta, supDiff;
+  std::uint64_t calibrationHash;
+  std::uint64_t gridOffset, productivityOffset, transitionOffset;
+  std::uint64_t valueOffset, policyOffset, policyIndexOffset;
+  std::uint64_t fileBytes;
+  std::uint64_t reserved;
+};
+
+static_assert(sizeof(SolutionFileHeader) == 128, "solution file header layout");
+
+const char solutionFileMagic[8] = {'R','B','C','S','O','L','0','1'};
+const std::uint32_t solutionFileByteOrder = 0x01020304;
+const std::uint64_t solutionFileAlignment = 64;
+
+// Read-only view of a solution file. open() maps the file (or reads it, where there is no
+// mmap) and checks the header and the size; the pointers stay valid until close() or the
+// destructor.
+class SolutionFile{
+public:
+  SolutionFile() : data(NULL), bytes(0), mapped(false) {}
+  ~SolutionFile(){ close(); }
+
+  bool open(const char* fileName){
+    close();
+#ifndef RBC_NO_MMAP
+    const int descriptor = ::open(fileName,O_RDONLY);
+    if (descriptor < 0){
+      return false;
+    }
+    struct stat status;
+    if (fstat(descriptor,&status) == 0 && status.st_size >= (off_t)sizeof(SolutionFileHeader)){
+      void* map = mmap(NULL,(size_t)status.st_size,PROT_READ,MAP_SHARED,descriptor,0);
+      if (map != MAP_FAILED){
+	data = (const char*)map;
+	bytes = (size_t)status.st_size;
+	mapped = true;
+      }
+    }
+    ::close(descriptor);
+#else
+    FILE* file = fopen(fileName,"rb");
+    if (file == NULL){
+      return false;
+    }
+    const std::int64_t size = file_size(file);
+    char* buffer = (size >= (std::int64_t)sizeof(SolutionFileHeader) && (std::uint64_t)size <= SIZE_MAX) ?
+      (char*)malloc((size_t)size) : NULL;
+    if (buffer != NULL && fread(buffer,1,(size_t)size,file) == (size_t)size){
+      data = buffer;
+      bytes = (size_t)size;
+    }
+    else{
+      free(buffer);
+    }
+    fclose(file);
+#endif
+    if (data == NULL || !valid()){
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close(){
+#ifndef RBC_NO_MMAP
+    if (mapped){
+      munmap((void*)data,bytes);
+    }
+#else
+    free((void*)data);
+#endif
+    data = NULL;
+    bytes = 0;
+    mapped = false;
+  }
+
+  const SolutionFileHeader& header() const { return *(const SolutionFileHeader*)data; }
+  int capital_points() const { return header().nGridCapital; }
+  int productivity_states() const { return header().nGridProductivity; }
+
+  const double* grid_capital() const { return (const double*)(data+header().gridOffset); }
+  const double* productivity() const { return (const double*)(data+header().productivityOffset); }
+  const double* transition() const { return (const double*)(data+header().transitionOffset); }
+  const double* value_function() const { return (const double*)(data+header().valueOffset); }
+  const double* policy_function() const { return (const double*)(data+header().policyOffset); }
+  const std::int32_t* policy_index() const { return (const std::int32_t*)(data+header().policyIndexOffset); }
+
+  double value(int nCapital, int nProductivity) const { return value_function()[(size_t)nCapital*productivity_states()+nProductivity]; }
+  double policy(int nCapital, int nProductivity) const { return policy_function()[(size_t)nCapital*productivity_states()+nProductivity]; }
+  int policy_index(int nCapital, int nProductivity) const { return policy_index()[(size_t)nCapital*productivity_states()+nProductivity]; }
+
+private:
+#ifdef RBC_NO_MMAP
+  // Bytes in file, or -1. long, and so ftell, has 32 bits on Windows, so files of 2 GB and
+  // more need the 64-bit calls.
+  static std::int64_t file_size(FILE* file){
+#if defined(_WIN32)
+    if (_fseeki64(file,0,SEEK_END) != 0){
+      return -1;
+    }
+    const std::int64_t size = _ftelli64(file);
+    _fseeki64(file,0,SEEK_SET);
+#else
+    if (fseeko(file,0,SEEK_END) != 0){
+      return -1;
+    }
+    const std::int64_t size = ftello(file);
+    fseeko(file,0,SEEK_SET);
+#endif
+    return size;
+  }
+
+#endif
+  SolutionFile(const SolutionFile&);
+  SolutionFile& operator=(const SolutionFile&);
+
+  // Every array must lie inside the file and be aligned
+  bool valid() const {
+    const SolutionFileHeader& h = header();
+    if (memcmp(h.magic,solutionFileMagic,sizeof(solutionFileMagic)) != 0 || h.headerBytes != sizeof(SolutionFileHeader) ||
+	h.byteOrder != solutionFileByteOrder || h.layout != 0 || h.nGridCapital < 1 || h.nGridProductivity < 1 ||
+	h.fileBytes != bytes){
+      return false;
+    }
+    const std::uint64_t nStates = (std::uint64_t)h.nGridCapital*h.nGridProductivity;
+    const std::uint64_t offsets[6] = {h.gridOffset, h.productivityOffset, h.transitionOffset, h.valueOffset, h.policyOffset, h.policyIndexOffset};
+    const std::uint64_t sizes[6] = {h.nGridCapital*sizeof(double), h.nGridProductivity*sizeof(double),
+				    (std::uint64_t)h.nGridProductivity*h.nGridProductivity*sizeof(double),
+				    nStates*sizeof(double), nStates*sizeof(double), nStates*sizeof(std::int32_t)};
+    for (int nArray = 0; nArray < 6; ++nArray){
+      if (offsets[nArray] % solutionFileAlignment != 0 || offsets[nArray] < sizeof(SolutionFileHeader) ||
+	  offsets[nArray] > bytes || sizes[nArray] > bytes-offsets[nArray]){
+	return false;
+      }
+    }
+    return true;
+  }
+
+  const char* data;
+  size_t bytes;
+  bool mapped;
+};
+
+} // namespace rbc
+
+#endif
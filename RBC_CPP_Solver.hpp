@@ -0,0 +1,2433 @@
+//============================================================================
+// Name        : RBC_CPP_Solver.hpp
+// Description : Solver library for the basic RBC model with full depreciation.
+//               A Model holds the calibration, the capital grid and the Markov chain
+//               of productivity; a Solver owns the buffers, which are reused by every
+//               call to solve(); a Solution holds the value and policy functions.
+//               Header only, so that drivers compile as a single file.
+//============================================================================
+
+#ifndef RBC_CPP_SOLVER_HPP
+#define RBC_CPP_SOLVER_HPP
+
+#include <iostream>
+#include <math.h>       // log, pow, ceil, exp, sqrt, erfc
+#include <cmath>        // abs
+#include <cstdlib>      // malloc
+#include <cstring>      // memset, memcpy
+#include <cstdio>       // fopen, fwrite, rename
+#include <fstream>      // reading checkpoints
+#include <stdexcept>    // runtime_error
+#include <cfloat>       // DBL_EPSILON, DBL_MAX
+#include <algorithm>    // min, max
+#include <string>
+#include <vector>
+#include <thread>       // threaded walk (link with -pthread)
+#include <atomic>
+#include <new>        // bad_alloc
+#include <chrono>       // maximization time with and without the utility cache
+#include <functional>   // sweep reports
+#include <mutex>        // sweep work queues
+#include <condition_variable> // thread pool
+#if defined(_WIN32)
+#include <io.h>         // _commit
+#else
+#include <unistd.h>     // fsync
+#endif
+
+#include "RBC_CPP_Solution.hpp"
+
+// SIMD evaluation engine: vector log and helpers for AVX2 (4 lanes) or SSE2 (2 lanes), or
+// AVX-512 (8 lanes) when RBC_AVX512 is defined. Compile with -march=native to enable them.
+// Walks are short (about two candidates per capital state once the policy settles), so
+// 4-lane windows usually beat 8-lane ones and AVX-512 is opt-in.
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define RBC_SIMD 1
+#endif
+
+namespace rbc {
+
+using std::min;
+using std::max;
+
+#ifdef RBC_SIMD
+#if defined(__AVX512F__) && defined(RBC_AVX512)
+const int vectorWidth = 8;
+typedef __m512d vdouble;
+typedef __m512i vint;
+inline vdouble v_load(const double* p){ return _mm512_loadu_pd(p); }
+inline void v_store(double* p, vdouble a){ _mm512_storeu_pd(p,a); }
+inline vdouble v_set(double a){ return _mm512_set1_pd(a); }
+inline vdouble v_add(vdouble a, vdouble b){ return _mm512_add_pd(a,b); }
+inline vdouble v_sub(vdouble a, vdouble b){ return _mm512_sub_pd(a,b); }
+inline vdouble v_mul(vdouble a, vdouble b){ return _mm512_mul_pd(a,b); }
+inline vdouble v_div(vdouble a, vdouble b){ return _mm512_div_pd(a,b); }
+inline int v_greater(vdouble a, vdouble b){ return (int)_mm512_cmp_pd_mask(a,b,_CMP_GT_OQ); }
+inline int v_less_equal(vdouble a, vdouble b){ return (int)_mm512_cmp_pd_mask(a,b,_CMP_LE_OQ); }
+inline vint v_bits(vdouble a){ return _mm512_castpd_si512(a); }
+inline vdouble v_double(vint a){ return _mm512_castsi512_pd(a); }
+inline vint vi_set(long long a){ return _mm512_set1_epi64(a); }
+inline vint vi_add(vint a, vint b){ return _mm512_add_epi64(a,b); }
+inline vint vi_and(vint a, vint b){ return _mm512_and_si512(a,b); }
+inline vint vi_or(vint a, vint b){ return _mm512_or_si512(a,b); }
+inline vint vi_exponent(vint a){ return _mm512_maskz_srli_epi64(0xff,a,52); }
+inline vdouble v_shift_in(double a, vdouble b){ return _mm512_castsi512_pd(_mm512_maskz_alignr_epi64(0xff,_mm512_castpd_si512(b),_mm512_castpd_si512(_mm512_set1_pd(a)),7)); }
+inline vdouble v_nan_unless_positive(vdouble x, vdouble a){ return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x,_mm512_setzero_pd(),_CMP_GT_OQ),_mm512_set1_pd(NAN),a); }
+#elif defined(__AVX2__)
+const int vectorWidth = 4;
+typedef __m256d vdouble;
+typedef __m256i vint;
+inline vdouble v_load(const double* p){ return _mm256_loadu_pd(p); }
+inline void v_store(double* p, vdouble a){ _mm256_storeu_pd(p,a); }
+inline vdouble v_set(double a){ return _mm256_set1_pd(a); }
+inline vdouble v_add(vdouble a, vdouble b){ return _mm256_add_pd(a,b); }
+inline vdouble v_sub(vdouble a, vdouble b){ return _mm256_sub_pd(a,b); }
+inline vdouble v_mul(vdouble a, vdouble b){ return _mm256_mul_pd(a,b); }
+inline vdouble v_div(vdouble a, vdouble b){ return _mm256_div_pd(a,b); }
+inline int v_greater(vdouble a, vdouble b){ return _mm256_movemask_pd(_mm256_cmp_pd(a,b,_CMP_GT_OQ)); }
+inline int v_less_equal(vdouble a, vdouble b){ return _mm256_movemask_pd(_mm256_cmp_pd(a,b,_CMP_LE_OQ)); }
+inline vint v_bits(vdouble a){ return _mm256_castpd_si256(a); }
+inline vdouble v_double(vint a){ return _mm256_castsi256_pd(a); }
+inline vint vi_set(long long a){ return _mm256_set1_epi64x(a); }
+inline vint vi_add(vint a, vint b){ return _mm256_add_epi64(a,b); }
+inline vint vi_and(vint a, vint b){ return _mm256_and_si256(a,b); }
+inline vint vi_or(vint a, vint b){ return _mm256_or_si256(a,b); }
+inline vint vi_exponent(vint a){ return _mm256_srli_epi64(a,52); }
+inline vdouble v_shift_in(double a, vdouble b){ return _mm256_blend_pd(_mm256_permute4x64_pd(b,0x93),_mm256_set1_pd(a),1); }
+inline vdouble v_nan_unless_positive(vdouble x, vdouble a){ return _mm256_or_pd(a,_mm256_andnot_pd(_mm256_cmp_pd(x,_mm256_setzero_pd(),_CMP_GT_OQ),_mm256_set1_pd(NAN))); }
+#else
+const int vectorWidth = 2;
+typedef __m128d vdouble;
+typedef __m128i vint;
+inline vdouble v_load(const double* p){ return _mm_loadu_pd(p); }
+inline void v_store(double* p, vdouble a){ _mm_storeu_pd(p,a); }
+inline vdouble v_set(double a){ return _mm_set1_pd(a); }
+inline vdouble v_add(vdouble a, vdouble b){ return _mm_add_pd(a,b); }
+inline vdouble v_sub(vdouble a, vdouble b){ return _mm_sub_pd(a,b); }
+inline vdouble v_mul(vdouble a, vdouble b){ return _mm_mul_pd(a,b); }
+inline vdouble v_div(vdouble a, vdouble b){ return _mm_div_pd(a,b); }
+inline int v_greater(vdouble a, vdouble b){ return _mm_movemask_pd(_mm_cmpgt_pd(a,b)); }
+inline int v_less_equal(vdouble a, vdouble b){ return _mm_movemask_pd(_mm_cmple_pd(a,b)); }
+inline vint v_bits(vdouble a){ return _mm_castpd_si128(a); }
+inline vdouble v_double(vint a){ return _mm_castsi128_pd(a); }
+inline vint vi_set(long long a){ return _mm_set1_epi64x(a); }
+inline vint vi_add(vint a, vint b){ return _mm_add_epi64(a,b); }
+inline vint vi_and(vint a, vint b){ return _mm_and_si128(a,b); }
+inline vint vi_or(vint a, vint b){ return _mm_or_si128(a,b); }
+inline vint vi_exponent(vint a){ return _mm_srli_epi64(a,52); }
+inline vdouble v_shift_in(double a, vdouble b){ return _mm_shuffle_pd(_mm_set1_pd(a),b,0); }
+inline vdouble v_nan_unless_positive(vdouble x, vdouble a){ return _mm_or_pd(a,_mm_andnot_pd(_mm_cmpgt_pd(x,_mm_setzero_pd()),_mm_set1_pd(NAN))); }
+#endif
+
+inline vdouble v_abs(vdouble a){
+  return v_double(vi_and(v_bits(a),vi_set(0x7fffffffffffffffLL)));
+}
+
+// Natural log with the fdlibm reduction and polynomial (error below 1 ulp for normal
+// positive arguments). Zero, negative and NaN arguments return NaN, so that a candidate
+// with non-positive consumption never improves the walk, as with the scalar log.
+inline vdouble v_log(vdouble x){
+  // x = 2^k*m with m in [sqrt(2)/2,sqrt(2))
+  const vint bits = vi_add(v_bits(x),vi_set(0x3ff0000000000000LL-0x3fe6a09e667f3bcdLL));
+  const vdouble m = v_double(vi_add(vi_and(bits,vi_set(0x000fffffffffffffLL)),vi_set(0x3fe6a09e667f3bcdLL)));
+  // k as a double through the 2^52+2^51 rounding constant
+  const vdouble k = v_sub(v_double(vi_add(vi_exponent(bits),vi_set(0x4338000000000000LL))),v_set(6755399441055744.0+1023.0));
+
+  const vdouble f = v_sub(m,v_set(1.0));
+  const vdouble s = v_div(f,v_add(v_set(2.0),f));
+  const vdouble z = v_mul(s,s);
+  const vdouble w = v_mul(z,z);
+  const vdouble t1 = v_mul(w,v_add(v_set(3.999999999940941908e-01),v_mul(w,v_add(v_set(2.222219843214978396e-01),v_mul(w,v_set(1.531383769920937332e-01))))));
+  const vdouble t2 = v_mul(z,v_add(v_set(6.666666666666735130e-01),v_mul(w,v_add(v_set(2.857142874366239149e-01),
+			   v_mul(w,v_add(v_set(1.818357216161805012e-01),v_mul(w,v_set(1.479819860511658591e-01))))))));
+  const vdouble hfsq = v_mul(v_set(0.5),v_mul(f,f));
+  const vdouble tail = v_add(v_mul(s,v_add(hfsq,v_add(t2,t1))),v_mul(k,v_set(1.90821492927058770002e-10)));
+  const vdouble result = v_sub(v_mul(k,v_set(6.93147180369123816490e-01)),v_sub(v_sub(hfsq,tail),f));
+
+  return v_nan_unless_positive(x,result);
+}
+#endif
+
+#ifdef RBC_SIMD
+inline int first_zero_bit(int mask){
+#if defined(__GNUC__)
+  return __builtin_ctz(~mask);
+#else
+  int bit = 0;
+  while (mask>>bit & 1){
+    ++bit;
+  }
+  return bit;
+#endif
+}
+
+// Batched SIMD maximization for one productivity state. The walks of batchSize consecutive
+// capital states all start at the policy of the state before the batch (or policyLowColumn
+// of the first state in the batch, if higher), so their candidate windows do not depend on
+// each other and are scored together; each walk is then resolved
+// from the window masks, continuing from the policy of the state before it or from its own
+// policyLowColumn, whichever is higher. A state whose
+// walk leaves its window, or whose path has two candidates too close for the vector log to
+// order them as the scalar log would, falls back to the scalar walk. Returns the number of
+// policy indices that changed and adds the candidates scored to evaluations.
+const int windowWidth = (vectorWidth > 4) ? vectorWidth : 4, batchSize = windowWidth;
+
+inline int vector_maximize(const double* vGridCapital, const double* outputColumn, const double* expectedColumn, double bbeta,
+			   int nGridCapital, double* valueColumn, double* policyColumn, int* policyIndexColumn,
+			   const int* policyLowColumn, long& evaluations){
+
+  const vdouble vUtilityWeight = v_set(1-bbeta), vBeta = v_set(bbeta);
+  const vdouble vTieBound = v_set(16*DBL_EPSILON);
+
+  // values[nBatch][0] is the sentinel before the first lane of each window
+  double values[batchSize][windowWidth+1];
+  int increases[batchSize], ties[batchSize];
+  vdouble vCapital[windowWidth/vectorWidth], vContinuation[windowWidth/vectorWidth];
+
+  int policyChanges = 0;
+  int nCapital, nCapitalNextPeriod, gridCapitalNextPeriod = 0;
+  double valueHighSoFar, valueProvisional, consumption;
+
+  for (int nCapitalBatch = 0; nCapitalBatch < nGridCapital; nCapitalBatch += batchSize){
+
+    gridCapitalNextPeriod = max(gridCapitalNextPeriod,policyLowColumn[nCapitalBatch]);
+    const int first = gridCapitalNextPeriod;
+    const int nBatchSize = min(batchSize,nGridCapital-nCapitalBatch);
+    evaluations += nBatchSize*windowWidth;
+    const int valid = (nGridCapital-first >= windowWidth) ? (1<<windowWidth)-1 : (1<<(nGridCapital-first))-1;
+
+    // The window of candidates is the same for every state in the batch
+    for (int lane = 0; lane < windowWidth; lane += vectorWidth){
+      vCapital[lane/vectorWidth] = v_load(vGridCapital+first+lane);
+      vContinuation[lane/vectorWidth] = v_mul(vBeta,v_load(expectedColumn+first+lane));
+    }
+
+    for (int nBatch = 0; nBatch < nBatchSize; ++nBatch){
+      const vdouble vOutput = v_set(outputColumn[nCapitalBatch+nBatch]);
+      values[nBatch][0] = -100000.0;
+      increases[nBatch] = 0;
+      ties[nBatch] = 0;
+      for (int lane = 0; lane < windowWidth; lane += vectorWidth){
+	const vdouble value = v_add(v_mul(vUtilityWeight,v_log(v_sub(vOutput,vCapital[lane/vectorWidth]))),vContinuation[lane/vectorWidth]);
+	// Each lane is compared with the one before it
+	const vdouble previous = v_shift_in(values[nBatch][lane],value);
+	increases[nBatch] |= v_greater(value,previous)<<lane;
+	ties[nBatch] |= v_less_equal(v_abs(v_sub(value,previous)),v_mul(vTieBound,v_add(v_abs(value),v_abs(previous))))<<lane;
+	v_store(values[nBatch]+lane+1,value);
+      }
+    }
+
+    for (int nBatch = 0; nBatch < nBatchSize; ++nBatch){
+
+      nCapital = nCapitalBatch+nBatch;
+      gridCapitalNextPeriod = max(gridCapitalNextPeriod,policyLowColumn[nCapital]);
+
+      // The walk starts at lane start, which is always accepted, and stops at the first
+      // later lane that does not improve on the one before it
+      const int start = gridCapitalNextPeriod-first;
+      if (start < windowWidth && values[nBatch][start+1] > -100000.0){
+	const int path = (2<<start)-1;
+	const int stop = first_zero_bit((increases[nBatch] & valid) | path);
+	if (stop < windowWidth && (ties[nBatch] & valid & ((2<<stop)-1) & ~path) == 0){
+	  gridCapitalNextPeriod = first+stop-1;
+	  valueColumn[nCapital] = values[nBatch][stop];
+	  policyColumn[nCapital] = vGridCapital[gridCapitalNextPeriod];
+	  policyChanges += (policyIndexColumn[nCapital] != gridCapitalNextPeriod);
+	  policyIndexColumn[nCapital] = gridCapitalNextPeriod;
+	  continue;
+	}
+      }
+
+      // Scalar walk
+      valueHighSoFar = -100000.0;
+      for (nCapitalNextPeriod = gridCapitalNextPeriod;nCapitalNextPeriod<nGridCapital;++nCapitalNextPeriod){
+	consumption = outputColumn[nCapital]-vGridCapital[nCapitalNextPeriod];
+	valueProvisional = (1-bbeta)*log(consumption)+bbeta*expectedColumn[nCapitalNextPeriod];
+	++evaluations;
+	if (valueProvisional>valueHighSoFar){
+	  valueHighSoFar = valueProvisional;
+	  gridCapitalNextPeriod = nCapitalNextPeriod;
+	}
+	else{
+	  break; // We break when we have achieved the max
+	}
+	valueColumn[nCapital] = valueHighSoFar;
+	policyColumn[nCapital] = vGridCapital[gridCapitalNextPeriod];
+      }
+      if (policyIndexColumn[nCapital] != gridCapitalNextPeriod){
+	++policyChanges;
+      }
+      policyIndexColumn[nCapital] = gridCapitalNextPeriod;
+    }
+  }
+
+  return policyChanges;
+}
+#endif
+
+// Expectation operator: the transition matrix stored by the structure of its nonzero
+// entries, chosen when it is built. Row nProductivity has the entries rowStart[nProductivity]
+// to rowStart[nProductivity+1]-1 of entryColumn and entryValue. The dense and banded kernels
+// store every entry from the first to the last nonzero of a row, so the columns are
+// consecutive and only the first is read; the sparse kernel (CSR) stores the nonzeros and
+// reads each column. Skipping zeros adds the same terms in the same order as the dense
+// product, so every kernel gives the same expected value.
+const int denseExpectation = 0, bandedExpectation = 1, sparseExpectation = 2;
+
+struct ExpectationOperator{
+  int kernel;
+  std::vector<int> rowStart, entryColumn;
+  std::vector<double> entryValue;
+
+  // The kernel is banded when the bands of the rows leave out some entries and are at least
+  // half nonzeros, sparse when under half of the matrix is nonzero, and dense otherwise.
+  // forcedKernel >= 0 overrides the choice.
+  void build(const double* mTransition, int nGridProductivity, int forcedKernel = -1){
+    std::vector<int> first(nGridProductivity), last(nGridProductivity);
+    int nonzeros = 0, bandEntries = 0;
+    for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+      first[nProductivity] = nGridProductivity;
+      last[nProductivity] = -1;
+      for (int nProductivityNextPeriod = 0; nProductivityNextPeriod < nGridProductivity; ++nProductivityNextPeriod){
+	if (mTransition[nProductivity*nGridProductivity+nProductivityNextPeriod] != 0.0){
+	  first[nProductivity] = min(first[nProductivity],nProductivityNextPeriod);
+	  last[nProductivity] = nProductivityNextPeriod;
+	  ++nonzeros;
+	}
+      }
+      bandEntries += max(last[nProductivity]-first[nProductivity]+1,0);
+    }
+
+    if (forcedKernel >= 0){
+      kernel = forcedKernel;
+    }
+    else if (bandEntries < nGridProductivity*nGridProductivity && 2*nonzeros >= bandEntries){
+      kernel = bandedExpectation;
+    }
+    else if (2*nonzeros < nGridProductivity*nGridProductivity){
+      kernel = sparseExpectation;
+    }
+    else{
+      kernel = denseExpectation;
+    }
+
+    rowStart.assign(1,0);
+    entryColumn.clear();
+    entryValue.clear();
+    for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+      const int low = (kernel == denseExpectation) ? 0 : first[nProductivity];
+      const int high = (kernel == denseExpectation) ? nGridProductivity-1 : last[nProductivity];
+      for (int nProductivityNextPeriod = low; nProductivityNextPeriod <= high; ++nProductivityNextPeriod){
+	const double transition = mTransition[nProductivity*nGridProductivity+nProductivityNextPeriod];
+	if (kernel != sparseExpectation || transition != 0.0){
+	  entryColumn.push_back(nProductivityNextPeriod);
+	  entryValue.push_back(transition);
+	}
+      }
+      rowStart.push_back((int)entryColumn.size());
+    }
+  }
+};
+
+// Rows [nCapitalBegin,nCapitalEnd) of the expected value for productivity state
+// nProductivity, element nCapital at expectedColumn[nCapital*capitalStride], from the value
+// function with element (nCapital,nProductivity) at nCapital*capitalStride+nProductivity*productivityStride
+inline void expected_rows(double* expectedColumn, const double* valueFunction, const ExpectationOperator& expectation, int nProductivity,
+			  size_t capitalStride, size_t productivityStride, int nCapitalBegin, int nCapitalEnd){
+  const int entryBegin = expectation.rowStart[nProductivity], nEntries = expectation.rowStart[nProductivity+1]-entryBegin;
+  const int* entryColumn = &expectation.entryColumn[0]+entryBegin;
+  const double* entryValue = &expectation.entryValue[0]+entryBegin;
+
+  if (expectation.kernel == sparseExpectation){
+    for (int nCapital = nCapitalBegin; nCapital < nCapitalEnd; ++nCapital){
+      double expected = 0.0;
+      for (int nEntry = 0; nEntry < nEntries; ++nEntry){
+	expected += entryValue[nEntry]*valueFunction[nCapital*capitalStride+entryColumn[nEntry]*productivityStride];
+      }
+      expectedColumn[nCapital*capitalStride] = expected;
+    }
+  }
+  else if (nEntries > 0){
+    const double* valueBand = valueFunction+entryColumn[0]*productivityStride;
+    for (int nCapital = nCapitalBegin; nCapital < nCapitalEnd; ++nCapital){
+      double expected = 0.0;
+      for (int nEntry = 0; nEntry < nEntries; ++nEntry){
+	expected += entryValue[nEntry]*valueBand[nCapital*capitalStride+nEntry*productivityStride];
+      }
+      expectedColumn[nCapital*capitalStride] = expected;
+    }
+  }
+  else{
+    for (int nCapital = nCapitalBegin; nCapital < nCapitalEnd; ++nCapital){
+      expectedColumn[nCapital*capitalStride] = 0.0;
+    }
+  }
+}
+
+// The same for a whole column in the column layout, one column of the value function at a
+// time, which streams through memory
+inline void expected_column(double* expectedColumn, const double* valueFunction, const ExpectationOperator& expectation, int nProductivity,
+			    size_t productivityStride, int nGridCapital){
+  for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+    expectedColumn[nCapital] = 0.0;
+  }
+  for (int nEntry = expectation.rowStart[nProductivity]; nEntry < expectation.rowStart[nProductivity+1]; ++nEntry){
+    const double transition = expectation.entryValue[nEntry];
+    const double* valueColumn = valueFunction+expectation.entryColumn[nEntry]*productivityStride;
+    for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+      expectedColumn[nCapital] += transition*valueColumn[nCapital];
+    }
+  }
+}
+
+// Instrumentation: with RBC_INSTRUMENT defined, solve() times the expectation, maximization
+// (or Howard) and convergence phases of each iteration, counts the candidates evaluated and
+// the walks of each length, and writes them as one JSON line per iteration to
+// Options::trace. Without it none of this is compiled. The fused sweep computes the
+// expected value inside the maximization, which then includes its time.
+#ifdef RBC_INSTRUMENT
+const int walkHistogramBins = 16;   // Walks of 0 to 14 candidates, and of 15 or more
+#endif
+
+// One productivity column of the Bellman maximization, shared by the walk and the divide and
+// conquer engines. When lazyExpected is set the walk computes the rows of the expected value
+// it reaches, nExpectedReady onwards, from valueFunction with the row nProductivity of
+// expectation (fused sweep).
+// When utilityCache is set, state nCapital has the period return of the cacheWidth choices
+// from bandStartColumn[nCapital] on at utilityCache[nCapital*capitalStride*cacheWidth].
+struct BellmanColumn{
+  const double* vGridCapital;
+  const double* outputColumn;
+  const double* expectedColumn;
+  double* valueColumn;
+  double* policyColumn;
+  int* policyIndexColumn;
+  const int* policyLowColumn;
+  const int* policyHighColumn;
+  size_t capitalStride;
+  double bbeta;
+  long evaluations;
+  int policyChanges;
+  double* lazyExpected;
+  const double* valueFunction;
+  const ExpectationOperator* expectation;
+  int nProductivity;
+  size_t productivityStride;
+  int nExpectedReady;
+  const double* utilityCache;
+  const int* bandStartColumn;
+  int cacheWidth;
+  long cacheHits;
+#ifdef RBC_INSTRUMENT
+  long walkLengths[walkHistogramBins];
+#endif
+};
+
+inline double candidate_value(BellmanColumn& column, int nCapital, int nCapitalNextPeriod){
+  ++column.evaluations;
+  if (column.utilityCache != NULL){
+    const unsigned offset = nCapitalNextPeriod-column.bandStartColumn[nCapital*column.capitalStride];
+    if (offset < (unsigned)column.cacheWidth){
+      ++column.cacheHits;
+      return column.utilityCache[nCapital*column.capitalStride*column.cacheWidth+offset]
+	+column.bbeta*column.expectedColumn[nCapitalNextPeriod*column.capitalStride];
+    }
+  }
+  double consumption = column.outputColumn[nCapital*column.capitalStride]-column.vGridCapital[nCapitalNextPeriod];
+  return (1-column.bbeta)*log(consumption)+column.bbeta*column.expectedColumn[nCapitalNextPeriod*column.capitalStride];
+}
+
+// First choice in [low,high] that does not improve on its successor, found by bisection
+// (the objective is concave in the choice). This is where the linear walk stops.
+inline int first_non_improving(BellmanColumn& column, int nCapital, int low, int high){
+  while (low < high){
+    const int middle = low+(high-low)/2;
+    if (candidate_value(column,nCapital,middle+1) > candidate_value(column,nCapital,middle)){
+      low = middle+1;
+    }
+    else{
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// Monotone walk over the capital states [nCapitalBegin,nCapitalEnd) of one productivity
+// state. Each state starts from the previous choice (monotonicity of the policy function),
+// the first one from gridCapitalNextPeriod, and stops at the first candidate that does not
+// improve on the one before it.
+inline void walk_maximize(BellmanColumn& column, int nGridCapital, int nCapitalBegin, int nCapitalEnd, int gridCapitalNextPeriod){
+
+  const int expectedBlock = 64;
+  const size_t capitalStride = column.capitalStride;
+
+  for (int nCapital = nCapitalBegin;nCapital<nCapitalEnd;++nCapital){
+
+    gridCapitalNextPeriod = max(gridCapitalNextPeriod,column.policyLowColumn[nCapital*capitalStride]);
+    double valueHighSoFar = -100000.0;
+    double capitalChoice  = column.vGridCapital[0];
+#ifdef RBC_INSTRUMENT
+    const long evaluationsBefore = column.evaluations;
+#endif
+
+    for (int nCapitalNextPeriod = gridCapitalNextPeriod;nCapitalNextPeriod<nGridCapital;++nCapitalNextPeriod){
+
+      if (nCapitalNextPeriod >= column.nExpectedReady){
+	const int nReady = min(nCapitalNextPeriod+expectedBlock,nGridCapital);
+	expected_rows(column.lazyExpected,column.valueFunction,*column.expectation,column.nProductivity,
+		      1,column.productivityStride,column.nExpectedReady,nReady);
+	column.nExpectedReady = nReady;
+      }
+
+      const double valueProvisional = candidate_value(column,nCapital,nCapitalNextPeriod);
+
+      if (valueProvisional>valueHighSoFar){
+	valueHighSoFar = valueProvisional;
+	capitalChoice = column.vGridCapital[nCapitalNextPeriod];
+	gridCapitalNextPeriod = nCapitalNextPeriod;
+      }
+      else{
+	break; // We break when we have achieved the max
+      }
+
+      column.valueColumn[nCapital*capitalStride] = valueHighSoFar;
+      column.policyColumn[nCapital*capitalStride] = capitalChoice;
+    }
+
+    if (column.policyIndexColumn[nCapital*capitalStride] != gridCapitalNextPeriod){
+      ++column.policyChanges;
+    }
+    column.policyIndexColumn[nCapital*capitalStride] = gridCapitalNextPeriod;
+#ifdef RBC_INSTRUMENT
+    ++column.walkLengths[min(column.evaluations-evaluationsBefore,(long)walkHistogramBins-1)];
+#endif
+  }
+}
+
+// Divide and conquer maximization for one productivity state (Heer and Maussner). The policy
+// of the middle capital point of a block is found by bisection, using concavity of the
+// objective in the choice, inside the bracket given by the policies of the block ends
+// (monotonicity of the policy function). It then bounds the search of each half, so a sweep
+// costs O(nGridCapital log nGridCapital) evaluations in the worst case. The bracket of each
+// point is also narrowed to [policyLowColumn, policyHighColumn].
+inline void binary_maximize(BellmanColumn& column, int nCapitalLow, int nCapitalHigh, int nCapitalNextPeriodLow, int nCapitalNextPeriodHigh){
+
+  while (nCapitalLow <= nCapitalHigh){
+
+    const int nCapital = nCapitalLow+(nCapitalHigh-nCapitalLow)/2;
+
+    int low = max(nCapitalNextPeriodLow,column.policyLowColumn[nCapital*column.capitalStride]);
+    int high = min(nCapitalNextPeriodHigh,column.policyHighColumn[nCapital*column.capitalStride]);
+    if (low > high){
+      low = nCapitalNextPeriodLow;
+      high = nCapitalNextPeriodHigh;
+    }
+    low = first_non_improving(column,nCapital,low,high);
+
+    column.valueColumn[nCapital*column.capitalStride] = candidate_value(column,nCapital,low);
+    column.policyColumn[nCapital*column.capitalStride] = column.vGridCapital[low];
+    if (column.policyIndexColumn[nCapital*column.capitalStride] != low){
+      ++column.policyChanges;
+    }
+    column.policyIndexColumn[nCapital*column.capitalStride] = low;
+
+    // Lower half by recursion, upper half in this loop
+    binary_maximize(column,nCapitalLow,nCapital-1,nCapitalNextPeriodLow,low);
+    nCapitalLow = nCapital+1;
+    nCapitalNextPeriodLow = low;
+  }
+}
+
+// Fused sweep helper: updates the smallest and largest change of a column of the value function
+inline void fold_difference(const double* valueNewColumn, const double* valueColumn, int nGridCapital,
+			    double& diffLow, double& diffHigh){
+  for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+    const double diff = valueNewColumn[nCapital]-valueColumn[nCapital];
+    diffLow = min(diffLow,diff);
+    diffHigh = max(diffHigh,diff);
+  }
+}
+
+// Aligned block of heap memory holding every matrix of the solver. It is allocated by the
+// first solve() that needs it and reused by all iterations and later calls.
+const size_t arenaAlignment = 64;
+
+inline size_t arena_size(size_t bytes){
+  return (bytes+arenaAlignment-1)/arenaAlignment*arenaAlignment;
+}
+
+inline void* arena_take(char*& arenaNext, size_t bytes){
+  void* block = arenaNext;
+  arenaNext += arena_size(bytes);
+  return block;
+}
+
+// Threads of a Solver, started by the first threaded pass and kept until the Solver is
+// destroyed. run() hands out tasks 0 to tasks-1 from a shared counter to nThreads threads,
+// the calling one included, and returns when all of them are done.
+class ThreadPool{
+public:
+  ThreadPool() : job(NULL), nTasks(0), nPending(0), nActive(0), generation(0), stopping(false) {}
+  ~ThreadPool(){ stop(); }
+
+  void run(int nThreads, int tasks, const std::function<void(int)>& task){
+    nThreads = max(1,min(nThreads,tasks));
+    if (nThreads == 1){
+      for (int nTask = 0; nTask < tasks; ++nTask){
+	task(nTask);
+      }
+      return;
+    }
+    while ((int)workers.size() < nThreads-1){
+      workers.push_back(std::thread(&ThreadPool::work,this));
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    job = &task;
+    nTasks = tasks;
+    nextTask = 0;
+    nPending = tasks;
+    ++generation;
+    wake.notify_all();
+    lock.unlock();
+    take_tasks(task,tasks);
+    lock.lock();
+    // No worker may still be taking tasks when the next call resets the counter
+    done.wait(lock,[this](){ return nPending == 0 && nActive == 0; });
+    job = NULL;
+  }
+
+  void stop(){
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (size_t nWorker = 0; nWorker < workers.size(); ++nWorker){
+      workers[nWorker].join();
+    }
+    workers.clear();
+    stopping = false;
+  }
+
+private:
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+
+  void take_tasks(const std::function<void(int)>& task, int tasks){
+    int nCompleted = 0;
+    for (int nTask = nextTask++; nTask < tasks; nTask = nextTask++){
+      task(nTask);
+      ++nCompleted;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    nPending -= nCompleted;
+    if (nPending == 0){
+      done.notify_all();
+    }
+  }
+
+  void work(){
+    long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true){
+      wake.wait(lock,[&](){ return stopping || generation != seen; });
+      if (stopping){
+	return;
+      }
+      seen = generation;
+      if (job == NULL){
+	continue; // Woken after the call it was meant for had finished
+      }
+      const std::function<void(int)>* task = job;
+      const int tasks = nTasks;
+      ++nActive;
+      lock.unlock();
+      take_tasks(*task,tasks);
+      lock.lock();
+      --nActive;
+      if (nPending == 0 && nActive == 0){
+	done.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  const std::function<void(int)>* job;
+  int nTasks, nPending, nActive;
+  std::atomic<int> nextTask;
+  long generation;
+  bool stopping;
+};
+
+// Threaded walk: the capital states of each productivity state are split into blocks, a few
+// per thread, which the threads take from a shared counter. A block starts where the serial
+// walk would arrive, guessed by bisection for the state before it. The guess is right when
+// the objective has a single peak; a Howard value function need not give one, so the guess
+// is then checked against the policy the block before it found, in order, and a block that
+// guessed wrong is walked again from that policy. The blocks are fixed by the grid and each
+// one writes only its own states, so which thread takes a block never changes the result:
+// the policies are those of the serial walk for any number of threads. The other threaded
+// loops (euler_errors, the simulation and the MEX kernel) share out their work in the same
+// way. previousIndex keeps the policy indices before the walk, to count the changes again.
+inline void threaded_walk(std::vector<BellmanColumn>& columns, int nGridCapital, int nThreads, ThreadPool& pool,
+			  std::vector<int>& previousIndex){
+
+  const int nGridProductivity = (int)columns.size();
+  const int nBlocksPerProductivity = max(1,(4*nThreads+nGridProductivity-1)/nGridProductivity);
+  const int nCapitalPerBlock = (nGridCapital+nBlocksPerProductivity-1)/nBlocksPerProductivity;
+  const int nBlocks = nGridProductivity*nBlocksPerProductivity;
+
+  std::vector<BellmanColumn> blocks(nBlocks);
+  std::vector<int> starts(nBlocks);
+  previousIndex.resize((size_t)nGridProductivity*nGridCapital);
+  pool.run(nThreads,nBlocks,[&](int nBlock){
+    const int nProductivity = nBlock/nBlocksPerProductivity;
+    const int nCapitalBegin = nBlock%nBlocksPerProductivity*nCapitalPerBlock;
+    const int nCapitalEnd = min(nCapitalBegin+nCapitalPerBlock,nGridCapital);
+    BellmanColumn& block = blocks[nBlock];
+    block = columns[nProductivity];
+    block.evaluations = 0;
+    block.policyChanges = 0;
+    block.cacheHits = 0;
+#ifdef RBC_INSTRUMENT
+    memset(block.walkLengths,0,sizeof(block.walkLengths));
+#endif
+    for (int nCapital = nCapitalBegin; nCapital < nCapitalEnd; ++nCapital){
+      previousIndex[(size_t)nProductivity*nGridCapital+nCapital] = block.policyIndexColumn[nCapital*block.capitalStride];
+    }
+    if (nCapitalBegin < nCapitalEnd){
+      starts[nBlock] = (nCapitalBegin == 0) ? 0 :
+	first_non_improving(block,nCapitalBegin-1,block.policyLowColumn[(nCapitalBegin-1)*block.capitalStride],nGridCapital-1);
+      walk_maximize(block,nGridCapital,nCapitalBegin,nCapitalEnd,starts[nBlock]);
+    }
+  });
+
+  for (int nBlock = 0; nBlock < nBlocks; ++nBlock){
+    const int nProductivity = nBlock/nBlocksPerProductivity;
+    const int nCapitalBegin = nBlock%nBlocksPerProductivity*nCapitalPerBlock;
+    const int nCapitalEnd = min(nCapitalBegin+nCapitalPerBlock,nGridCapital);
+    BellmanColumn& block = blocks[nBlock];
+    if (nCapitalBegin == 0 || nCapitalBegin >= nCapitalEnd ||
+	block.policyIndexColumn[(nCapitalBegin-1)*block.capitalStride] == starts[nBlock]){
+      continue;
+    }
+    for (int nCapital = nCapitalBegin; nCapital < nCapitalEnd; ++nCapital){
+      block.policyIndexColumn[nCapital*block.capitalStride] = previousIndex[(size_t)nProductivity*nGridCapital+nCapital];
+    }
+    block.policyChanges = 0;
+#ifdef RBC_INSTRUMENT
+    memset(block.walkLengths,0,sizeof(block.walkLengths));
+#endif
+    walk_maximize(block,nGridCapital,nCapitalBegin,nCapitalEnd,block.policyIndexColumn[(nCapitalBegin-1)*block.capitalStride]);
+  }
+
+  for (int nBlock = 0; nBlock < nBlocks; ++nBlock){
+    columns[nBlock/nBlocksPerProductivity].evaluations += blocks[nBlock].evaluations;
+    columns[nBlock/nBlocksPerProductivity].policyChanges += blocks[nBlock].policyChanges;
+    columns[nBlock/nBlocksPerProductivity].cacheHits += blocks[nBlock].cacheHits;
+#ifdef RBC_INSTRUMENT
+    for (int nBin = 0; nBin < walkHistogramBins; ++nBin){
+      columns[nBlock/nBlocksPerProductivity].walkLengths[nBin] += blocks[nBlock].walkLengths[nBin];
+    }
+#endif
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Model, options and solution
+///////////////////////////////////////////////////////////////////////////////////////////
+
+// Calibration, capital grid and productivity process. The default is the calibration of the
+// paper, with 17820 capital points 0.00001 apart from half of steady state capital. Models
+// that set vGridCapitalShared use that grid of nGridCapital points instead, so that several
+// calibrations can share one grid and start from each other's value functions.
+struct Model{
+  double aalpha;                    // Elasticity of output w.r.t. capital
+  double bbeta;                     // Discount factor
+  int nGridCapital;
+  double lowerBound, upperBound;    // Fractions of steady state capital
+  bool defaultGrid;                 // Step of 0.00001 from lowerBound, ignoring upperBound
+  std::vector<double> vProductivity;
+  std::vector<double> mTransition;  // By rows
+  const double* vGridCapitalShared;
+
+  Model() : aalpha(0.33333333333), bbeta(0.95), nGridCapital(17820), lowerBound(0.5), upperBound(1.5), defaultGrid(true),
+	    vGridCapitalShared(NULL){
+    const double vProductivityDefault[5] = {0.9792, 0.9896, 1.0000, 1.0106, 1.0212};
+    const double mTransitionDefault[25] = {
+			0.9727, 0.0273, 0.0000, 0.0000, 0.0000,
+			0.0041, 0.9806, 0.0153, 0.0000, 0.0000,
+			0.0000, 0.0082, 0.9837, 0.0082, 0.0000,
+			0.0000, 0.0000, 0.0153, 0.9806, 0.0041,
+			0.0000, 0.0000, 0.0000, 0.0273, 0.9727
+			};
+    vProductivity.assign(vProductivityDefault,vProductivityDefault+5);
+    mTransition.assign(mTransitionDefault,mTransitionDefault+25);
+  }
+
+  int productivity_states() const { return (int)vProductivity.size(); }
+  double capital_steady_state() const { return pow(aalpha*bbeta,1/(1-aalpha)); }
+  double grid_step() const { return defaultGrid ? 0.00001 : (upperBound-lowerBound)*capital_steady_state()/(nGridCapital-1); }
+
+  // The grid of capital of this calibration
+  std::vector<double> grid_capital() const {
+    std::vector<double> vGridCapital(nGridCapital);
+    for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+      vGridCapital[nCapital] = lowerBound*capital_steady_state()+grid_step()*nCapital;
+    }
+    return vGridCapital;
+  }
+
+  // Reads nGridProductivity, the productivity values and the transition matrix by rows
+  bool read_productivity(std::istream& input){
+    int nGridProductivity;
+    if (!(input >> nGridProductivity) || nGridProductivity < 1){
+      return false;
+    }
+    std::vector<double> values(nGridProductivity+nGridProductivity*nGridProductivity);
+    for (size_t n = 0; n < values.size(); ++n){
+      if (!(input >> values[n])){
+	return false;
+      }
+    }
+    vProductivity.assign(values.begin(),values.begin()+nGridProductivity);
+    mTransition.assign(values.begin()+nGridProductivity,values.end());
+    return true;
+  }
+
+  // Discretizations of log productivity z' = rho*z + sigma*e, e ~ N(0,1), with
+  // nGridProductivity states. Tauchen spaces the states evenly over width unconditional
+  // standard deviations and integrates the normal density over the interval of each state,
+  // taking both tails from erfc so that small probabilities keep their precision.
+  // Rouwenhorst spaces them over sqrt(nGridProductivity-1) standard deviations and builds the
+  // transition matrix by the recursion of Kopecky and Suen, which matches the persistence
+  // and the unconditional variance exactly. Both normalize every row to sum to one and
+  // return the transition_error() of the matrix before, which only rounding should move
+  // away from zero.
+  double tauchen(int nGridProductivity, double rho, double sigma, double width = 3.0){
+    const double sigmaZ = sigma/sqrt(1-rho*rho);
+    const double step = (nGridProductivity > 1) ? 2*width*sigmaZ/(nGridProductivity-1) : 0.0;
+    std::vector<double> z(nGridProductivity);
+    for (int n = 0; n < nGridProductivity; ++n){
+      z[n] = (nGridProductivity > 1) ? -width*sigmaZ+step*n : 0.0;
+    }
+
+    // Probability that rho*z[nFrom]+sigma*e lies below (lower) or above (upper) x
+    const double scale = 1/(sigma*sqrt(2.0));
+    mTransition.assign(nGridProductivity*nGridProductivity,0.0);
+    for (int nFrom = 0; nFrom < nGridProductivity; ++nFrom){
+      for (int nTo = 0; nTo < nGridProductivity; ++nTo){
+	const double low = (z[nTo]-0.5*step-rho*z[nFrom])*scale, high = (z[nTo]+0.5*step-rho*z[nFrom])*scale;
+	double probability;
+	if (nGridProductivity == 1){
+	  probability = 1.0;
+	}
+	else if (nTo == 0){
+	  probability = 0.5*erfc(-high);
+	}
+	else if (nTo == nGridProductivity-1){
+	  probability = 0.5*erfc(low);
+	}
+	else if (low > 0){
+	  probability = 0.5*(erfc(low)-erfc(high));
+	}
+	else{
+	  probability = 0.5*(erfc(-high)-erfc(-low));
+	}
+	mTransition[nFrom*nGridProductivity+nTo] = probability;
+      }
+    }
+    return set_log_productivity(z);
+  }
+
+  double rouwenhorst(int nGridProductivity, double rho, double sigma){
+    const double sigmaZ = sigma/sqrt(1-rho*rho);
+    const double p = (1+rho)/2;
+    std::vector<double> z(nGridProductivity);
+    for (int n = 0; n < nGridProductivity; ++n){
+      z[n] = (nGridProductivity > 1) ? sigmaZ*sqrt(nGridProductivity-1.0)*(2.0*n/(nGridProductivity-1)-1) : 0.0;
+    }
+
+    // The matrix of n states from the one of n-1 states, theta
+    std::vector<double> theta(1,1.0);
+    for (int n = 2; n <= nGridProductivity; ++n){
+      std::vector<double> next(n*n,0.0);
+      for (int nFrom = 0; nFrom < n-1; ++nFrom){
+	for (int nTo = 0; nTo < n-1; ++nTo){
+	  const double entry = theta[nFrom*(n-1)+nTo];
+	  next[nFrom*n+nTo] += p*entry;
+	  next[nFrom*n+nTo+1] += (1-p)*entry;
+	  next[(nFrom+1)*n+nTo] += (1-p)*entry;
+	  next[(nFrom+1)*n+nTo+1] += p*entry;
+	}
+      }
+      for (int nFrom = 1; nFrom < n-1; ++nFrom){
+	for (int nTo = 0; nTo < n; ++nTo){
+	  next[nFrom*n+nTo] *= 0.5;
+	}
+      }
+      theta.swap(next);
+    }
+    mTransition = theta;
+    return set_log_productivity(z);
+  }
+
+  // FNV-1a hash of the calibration, the grid and the productivity process, which identifies
+  // the checkpoints of this model
+  unsigned long long calibration_hash() const {
+    unsigned long long hash = 14695981039346656037ULL;
+    const auto mix = [&hash](const void* data, size_t bytes){
+      for (size_t n = 0; n < bytes; ++n){
+	hash = (hash^((const unsigned char*)data)[n])*1099511628211ULL;
+      }
+    };
+    mix(&aalpha,sizeof(aalpha));
+    mix(&bbeta,sizeof(bbeta));
+    mix(&nGridCapital,sizeof(nGridCapital));
+    mix(&lowerBound,sizeof(lowerBound));
+    mix(&upperBound,sizeof(upperBound));
+    mix(&defaultGrid,sizeof(defaultGrid));
+    mix(&vProductivity[0],vProductivity.size()*sizeof(double));
+    mix(&mTransition[0],mTransition.size()*sizeof(double));
+    if (vGridCapitalShared != NULL){
+      mix(vGridCapitalShared,nGridCapital*sizeof(double));
+    }
+    return hash;
+  }
+
+  // Largest distance of a row sum of the transition matrix from one, or infinity if the
+  // matrix has the wrong size or a negative or non-finite entry
+  double transition_error() const {
+    const int nGridProductivity = productivity_states();
+    if (nGridProductivity < 1 || mTransition.size() != (size_t)nGridProductivity*nGridProductivity){
+      return HUGE_VAL;
+    }
+    double error = 0.0;
+    for (int nFrom = 0; nFrom < nGridProductivity; ++nFrom){
+      double sum = 0.0;
+      for (int nTo = 0; nTo < nGridProductivity; ++nTo){
+	const double entry = mTransition[nFrom*nGridProductivity+nTo];
+	if (!(entry >= 0.0 && entry <= 1.0)){
+	  return HUGE_VAL;
+	}
+	sum += entry;
+      }
+      error = max(error,std::abs(sum-1.0));
+    }
+    return error;
+  }
+
+private:
+  // Productivity is exp(z); rows of mTransition are normalized to sum to one. Returns the
+  // transition_error() before the normalization.
+  double set_log_productivity(const std::vector<double>& z){
+    const int nGridProductivity = (int)z.size();
+    vProductivity.resize(nGridProductivity);
+    const double error = transition_error();
+    for (int n = 0; n < nGridProductivity; ++n){
+      vProductivity[n] = exp(z[n]);
+      double sum = 0.0;
+      for (int nTo = 0; nTo < nGridProductivity; ++nTo){
+	sum += mTransition[n*nGridProductivity+nTo];
+      }
+      for (int nTo = 0; nTo < nGridProductivity; ++nTo){
+	mTransition[n*nGridProductivity+nTo] /= sum;
+      }
+    }
+    return error;
+  }
+};
+
+const int scalarEngine = 0, vectorEngine = 1, binaryEngine = 2, egmEngine = 3, splineEngine = 4;
+
+// How to solve. Howard acceleration runs the maximization every howardSteps iterations and
+// applies the fixed policy in between. The maximization walks the candidates one at a time
+// (scalarEngine, on nThreads threads), with the SIMD evaluation engine (vectorEngine) or by
+// divide and conquer with bisection (binaryEngine). egmEngine replaces value function
+// iteration with the endogenous grid method (see Solver::solve_egm), and splineEngine
+// iterates on a grid of splineGridPoints with continuous choices (see Solver::solve_spline);
+// both take only tolerance and progress. With nThreads > 1 the expected value and the
+// convergence test of the grid-search engines run on the same threads, which the Solver
+// starts once and keeps across solves. The fused sweep makes one pass per iteration; it
+// and the vector engine use the column layout. Iteration stops on the sup
+// norm of the update or, with the MacQueen-Porteus bounds, once the policy is stable and
+// the bounds on the fixed point are within tolerance. With coarsening > 1 the solve starts
+// on a grid with about 1/coarsening of the points, but no fewer than 128, and doubles it up
+// to nGridCapital.
+// With utilityCacheMB > 0 the scalar and binary engines keep the period return of a band
+// of up to four choices around the policy of each state, as wide as fits in that many MB,
+// once the policy of the full grid has settled; choices outside the band compute it as before.
+// With checkpointFile the state of the full grid is saved there every checkpointInterval
+// iterations; with resume a solve of the same model continues from that checkpoint.
+// trace receives the instrumentation of each iteration when RBC_INSTRUMENT is defined.
+struct Options{
+  int howardSteps;
+  bool columnLayout;
+  int engine;
+  bool fusedSweep;
+  bool boundsConvergence;
+  int coarsening;
+  int nThreads;
+  double tolerance;
+  double utilityCacheMB;
+  int expectationKernel;            // denseExpectation, bandedExpectation, sparseExpectation, or -1 to choose from the matrix
+  int splineGridPoints;             // Capital points of splineEngine
+  const char* checkpointFile;       // Or NULL
+  int checkpointInterval;
+  bool resume;
+  std::ostream* progress;           // Iteration log, or NULL
+  std::ostream* trace;              // JSON lines of the instrumentation, or NULL
+
+  Options() : howardSteps(1), columnLayout(false), engine(scalarEngine), fusedSweep(false), boundsConvergence(false),
+	      coarsening(1), nThreads(1), tolerance(0.0000001), utilityCacheMB(0.0), expectationKernel(-1), splineGridPoints(200),
+	      checkpointFile(NULL), checkpointInterval(50), resume(false), progress(NULL),
+	      trace(NULL) {}
+};
+
+// Value and policy functions, element (nCapital,nProductivity) at nCapital*nGridProductivity+nProductivity
+struct Solution{
+  int nGridCapital, nGridProductivity;
+  std::vector<double> vGridCapital;
+  std::vector<double> mValueFunction, mPolicyFunction;
+  std::vector<int> mPolicyIndex;
+
+  int iterations, maximizations;
+  long evaluations;                 // Candidates scored by all maximizations
+  double supDiff;                   // Last sup norm of the update, or bound gap
+  double plainDifference;           // Last sup norm of the update of plain value function iteration
+  double bytesPerIteration;         // Memory traffic model
+
+  size_t utilityCacheBytes;         // Footprint of the utility cache, 0 without it
+  int utilityCacheWidth;            // Choices cached per state
+  long cacheHits;                   // Evaluations served by the utility cache
+  double uncachedMaximizationTime;  // Mean seconds per maximization before the cache was built
+  double cachedMaximizationTime;    // and after
+  int expectationKernel;            // Kernel of the expectation operator
+  int resumedIteration;             // Iteration of the checkpoint the solve resumed from, or 0
+
+  Solution() : nGridCapital(0), nGridProductivity(0), iterations(0), maximizations(0), evaluations(0),
+	       supDiff(0.0), plainDifference(0.0), bytesPerIteration(0.0), utilityCacheBytes(0), utilityCacheWidth(0), cacheHits(0),
+	       uncachedMaximizationTime(0.0), cachedMaximizationTime(0.0), expectationKernel(denseExpectation),
+	       resumedIteration(0) {}
+
+  double value(int nCapital, int nProductivity) const { return mValueFunction[nCapital*nGridProductivity+nProductivity]; }
+  double policy(int nCapital, int nProductivity) const { return mPolicyFunction[nCapital*nGridProductivity+nProductivity]; }
+  int policy_index(int nCapital, int nProductivity) const { return mPolicyIndex[nCapital*nGridProductivity+nProductivity]; }
+
+  // FNV-1a hash of the bytes of mPolicyIndex, which compares whole policies across programs
+  // (RBC_Benchmark.py computes it from the policy indices of a solution file)
+  unsigned long long policy_checksum() const {
+    unsigned long long hash = 14695981039346656037ULL;
+    const unsigned char* bytes = (const unsigned char*)&mPolicyIndex[0];
+    for (size_t n = 0; n < mPolicyIndex.size()*sizeof(int); ++n){
+      hash = (hash^bytes[n])*1099511628211ULL;
+    }
+    return hash;
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Checkpoints
+///////////////////////////////////////////////////////////////////////////////////////////
+
+// A checkpoint is this 64-byte header followed by the value function (doubles) and the
+// policy indices (ints) of the full grid, element (nCapital,nProductivity) at
+// nCapital*nGridProductivity+nProductivity, in the byte order of the machine, so that the
+// file can be memory-mapped. It is written to fileName.tmp, flushed to disk and renamed
+// over fileName, so a job stopped while writing leaves the previous checkpoint intact.
+// howardSteps is the schedule levelIteration counts in; a solve resumed with other Howard
+// steps starts a new schedule with a maximization.
+struct CheckpointHeader{
+  char magic[8];                    // "RBCCKPT1"
+  unsigned long long calibrationHash;
+  int nGridCapital, nGridProductivity;
+  int iteration, levelIteration, maximizations, howardSteps;
+  long long evaluations;
+  double accumulatedShift, bytesMoved;
+};
+
+static_assert(sizeof(CheckpointHeader) == 64, "checkpoint header layout");
+
+const char checkpointMagic[8] = {'R','B','C','C','K','P','T','1'};
+
+// Closes output, written to temporaryName, once its contents are on disk, and renames it
+// over fileName: a crash leaves either the old file or the whole new one under fileName.
+// written is false if an earlier write failed. what names the file in the errors.
+inline void commit_file(std::FILE* output, bool written, const std::string& temporaryName, const char* fileName, const char* what){
+  written = written && std::fflush(output) == 0;
+#if defined(_WIN32)
+  written = written && _commit(_fileno(output)) == 0;
+#else
+  written = written && fsync(fileno(output)) == 0;
+#endif
+  written = std::fclose(output) == 0 && written;
+  if (!written){
+    throw std::runtime_error(std::string("Cannot write the ")+what+" "+temporaryName);
+  }
+  if (std::rename(temporaryName.c_str(),fileName) != 0){
+    throw std::runtime_error(std::string("Cannot rename the ")+what+" "+temporaryName);
+  }
+}
+
+inline void write_checkpoint(const char* fileName, const CheckpointHeader& header, const Solution& state){
+  const std::string temporaryName = std::string(fileName)+".tmp";
+  std::FILE* output = std::fopen(temporaryName.c_str(),"wb");
+  if (output == NULL){
+    throw std::runtime_error("Cannot write the checkpoint "+temporaryName);
+  }
+  const bool written = std::fwrite(&header,sizeof(header),1,output) == 1 &&
+    std::fwrite(&state.mValueFunction[0],sizeof(double),state.mValueFunction.size(),output) == state.mValueFunction.size() &&
+    std::fwrite(&state.mPolicyIndex[0],sizeof(int),state.mPolicyIndex.size(),output) == state.mPolicyIndex.size();
+  commit_file(output,written,temporaryName,fileName,"checkpoint");
+}
+
+// Reads a checkpoint into header and the value function and policy indices of state.
+// Returns false if there is no complete checkpoint in fileName.
+inline bool read_checkpoint(const char* fileName, CheckpointHeader& header, Solution& state){
+  std::ifstream input(fileName,std::ios::binary);
+  if (!input.read((char*)&header,sizeof(header)) || memcmp(header.magic,checkpointMagic,sizeof(checkpointMagic)) != 0 ||
+      header.nGridCapital < 2 || header.nGridProductivity < 1){
+    return false;
+  }
+  const size_t nStates = (size_t)header.nGridCapital*header.nGridProductivity;
+  state.nGridCapital = header.nGridCapital;
+  state.nGridProductivity = header.nGridProductivity;
+  state.mValueFunction.resize(nStates);
+  state.mPolicyIndex.resize(nStates);
+  input.read((char*)&state.mValueFunction[0],nStates*sizeof(double));
+  input.read((char*)&state.mPolicyIndex[0],nStates*sizeof(int));
+  return (bool)input;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Export
+///////////////////////////////////////////////////////////////////////////////////////////
+
+// Writes the solution of model in the format of RBC_CPP_Solution.hpp to fileName.tmp, then
+// flushed to disk and renamed over fileName. Each array goes out in one write, from where
+// the solution keeps it. Throws std::runtime_error if the file cannot be written.
+inline void write_solution(const char* fileName, const Model& model, const Solution& solution){
+  const std::uint64_t nStates = (std::uint64_t)solution.nGridCapital*solution.nGridProductivity;
+  const void* arrays[6] = {&solution.vGridCapital[0], &model.vProductivity[0], &model.mTransition[0],
+			   &solution.mValueFunction[0], &solution.mPolicyFunction[0], &solution.mPolicyIndex[0]};
+  const std::uint64_t sizes[6] = {solution.nGridCapital*sizeof(double), solution.nGridProductivity*sizeof(double),
+				  (std::uint64_t)solution.nGridProductivity*solution.nGridProductivity*sizeof(double),
+				  nStates*sizeof(double), nStates*sizeof(double), nStates*sizeof(int)};
+  static_assert(sizeof(int) == sizeof(std::int32_t), "policy indices are written as int32");
+
+  SolutionFileHeader header;
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,solutionFileMagic,sizeof(solutionFileMagic));
+  header.headerBytes = sizeof(header);
+  header.byteOrder = solutionFileByteOrder;
+  header.nGridCapital = solution.nGridCapital;
+  header.nGridProductivity = solution.nGridProductivity;
+  header.layout = 0;
+  header.iterations = solution.iterations;
+  header.aalpha = model.aalpha;
+  header.bbeta = model.bbeta;
+  header.supDiff = solution.supDiff;
+  header.calibrationHash = model.calibration_hash();
+  std::uint64_t* offsets[6] = {&header.gridOffset, &header.productivityOffset, &header.transitionOffset,
+			       &header.valueOffset, &header.policyOffset, &header.policyIndexOffset};
+  std::uint64_t fileBytes = sizeof(header);
+  for (int nArray = 0; nArray < 6; ++nArray){
+    fileBytes = (fileBytes+solutionFileAlignment-1)/solutionFileAlignment*solutionFileAlignment;
+    *offsets[nArray] = fileBytes;
+    fileBytes += sizes[nArray];
+  }
+  header.fileBytes = fileBytes;
+
+  const std::string temporaryName = std::string(fileName)+".tmp";
+  std::FILE* output = std::fopen(temporaryName.c_str(),"wb");
+  if (output == NULL){
+    throw std::runtime_error("Cannot write the solution "+temporaryName);
+  }
+  const char padding[solutionFileAlignment] = {0};
+  bool written = std::fwrite(&header,sizeof(header),1,output) == 1;
+  std::uint64_t end = sizeof(header);
+  for (int nArray = 0; nArray < 6 && written; ++nArray){
+    const size_t nPadding = (size_t)(*offsets[nArray]-end);
+    written = std::fwrite(padding,1,nPadding,output) == nPadding &&
+      std::fwrite(arrays[nArray],1,(size_t)sizes[nArray],output) == sizes[nArray];
+    end = *offsets[nArray]+sizes[nArray];
+  }
+  commit_file(output,written,temporaryName,fileName,"solution");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Solver
+///////////////////////////////////////////////////////////////////////////////////////////
+
+class Solver{
+public:
+  Solver() : arena(NULL), arenaCapacity(0) {}
+  ~Solver(){ free(arena); }
+
+  // The solution stays valid, and its storage is reused, until the next call. A warm start
+  // from the solution of a model on the same grid replaces the zero value function (and
+  // the multigrid), and so does a checkpoint to resume from. Throws std::runtime_error if
+  // a checkpoint cannot be written.
+  const Solution& solve(const Model& model, const Options& options, const Solution* warmStart = NULL);
+  const Solution& solution() const { return solution_; }
+
+private:
+  const Solution& solve_egm(const Model& model, const Options& options);
+  const Solution& solve_spline(const Model& model, const Options& options);
+
+  Solver(const Solver&);
+  Solver& operator=(const Solver&);
+
+  char* arena;
+  size_t arenaCapacity;
+  std::vector<BellmanColumn> columns;
+  ExpectationOperator expectation;
+  ThreadPool pool;
+  std::vector<int> previousIndex;
+  Solution checkpoint;
+  Solution solution_;
+};
+
+inline const Solution& Solver::solve(const Model& model, const Options& options, const Solution* warmStart){
+
+  if (options.engine == egmEngine){
+    return solve_egm(model,options);
+  }
+  if (options.engine == splineEngine){
+    return solve_spline(model,options);
+  }
+
+  const double aalpha = model.aalpha, bbeta = model.bbeta;
+  const int nGridCapital = model.nGridCapital, nGridProductivity = model.productivity_states();
+  const double* vProductivity = &model.vProductivity[0];
+  expectation.build(&model.mTransition[0],nGridProductivity,options.expectationKernel);
+
+  const int howardSteps = max(options.howardSteps,1);
+  const int engine = options.engine;
+  const bool fusedSweep = options.fusedSweep, boundsConvergence = options.boundsConvergence;
+  const bool columnLayout = options.columnLayout || engine == vectorEngine || fusedSweep;
+  const bool threadedWalk = engine == scalarEngine && options.nThreads > 1;
+  const int nThreads = max(options.nThreads,1);
+  const double tolerance = options.tolerance;
+  std::ostream* progress = options.progress;
+
+  ///////////////////////////////////////////////////////////////////////////////////////////
+  // 1. Memory
+  ///////////////////////////////////////////////////////////////////////////////////////////
+
+  // Columns are padded to a multiple of 8 doubles so that each one starts on a 64-byte
+  // boundary, with at least 8 more so that the vector engine can read past the last point
+  const size_t nPaddedCapital = (nGridCapital+15)/8*8;
+  const size_t nStates = nPaddedCapital*nGridProductivity;
+
+  // The utility cache holds cacheWidth returns and the first choice of the band for each
+  // state, with the widest band up to maxCacheWidth that fits in utilityCacheMB. The vector
+  // engine computes its own returns and has no cache.
+  const int maxCacheWidth = 4;
+  const double cacheBudget = options.utilityCacheMB*1048576.0;
+  int cacheWidth = (engine == vectorEngine || options.utilityCacheMB <= 0.0) ? 0 : min(maxCacheWidth,nGridCapital);
+  while (cacheWidth > 0 && arena_size(nStates*cacheWidth*sizeof(double))+arena_size(nStates*sizeof(int)) > cacheBudget){
+    --cacheWidth;
+  }
+  const size_t cacheBytes = (cacheWidth == 0) ? 0 : arena_size(nStates*cacheWidth*sizeof(double))+arena_size(nStates*sizeof(int));
+  if (progress != NULL && cacheWidth == 0 && engine != vectorEngine && options.utilityCacheMB > 0.0){
+    *progress <<"Utility cache of "<<options.utilityCacheMB<<" MB is below the "
+	      <<(arena_size(nStates*sizeof(double))+arena_size(nStates*sizeof(int)))/1048576.0
+	      <<" MB of one choice per state, solving without it\n";
+  }
+
+  const size_t arenaBytes = arena_size(nPaddedCapital*sizeof(double))
+    + 6*arena_size(nStates*sizeof(double))
+    + 3*arena_size(nStates*sizeof(int))
+    + cacheBytes;
+
+  if (arenaBytes > arenaCapacity){
+    free(arena);
+    arena = (char*)malloc(arenaBytes+arenaAlignment);
+    arenaCapacity = (arena == NULL) ? 0 : arenaBytes;
+    if (arena == NULL){
+      throw std::bad_alloc();
+    }
+  }
+  char* arenaNext = arena+(arenaAlignment-(size_t)arena%arenaAlignment)%arenaAlignment;
+  memset(arenaNext,0,arenaBytes);
+
+  double* vGridCapital = (double*)arena_take(arenaNext,nPaddedCapital*sizeof(double));
+  double* mOutput = (double*)arena_take(arenaNext,nStates*sizeof(double));
+  double* mValueFunction = (double*)arena_take(arenaNext,nStates*sizeof(double));
+  double* mValueFunctionNew = (double*)arena_take(arenaNext,nStates*sizeof(double));
+  double* mPolicyFunction = (double*)arena_take(arenaNext,nStates*sizeof(double));
+  double* expectedValueFunction = (double*)arena_take(arenaNext,nStates*sizeof(double));
+
+  // Policy as grid indices and its period return, used by the Howard improvement steps
+  double* mPolicyReturn = (double*)arena_take(arenaNext,nStates*sizeof(double));
+  int* mPolicyIndex = (int*)arena_take(arenaNext,nStates*sizeof(int));
+
+  // Bracket of the policy index of each state, set from the coarser level of the multigrid
+  int* mPolicyLow = (int*)arena_take(arenaNext,nStates*sizeof(int));
+  int* mPolicyHigh = (int*)arena_take(arenaNext,nStates*sizeof(int));
+
+  // Utility cache: the returns of state nState are at mUtility[nState*cacheWidth]
+  double* mUtility = (cacheWidth == 0) ? NULL : (double*)arena_take(arenaNext,nStates*cacheWidth*sizeof(double));
+  int* mBandStart = (cacheWidth == 0) ? NULL : (int*)arena_take(arenaNext,nStates*sizeof(int));
+
+  // Element (nCapital,nProductivity) of every matrix is at nCapital*capitalStride+nProductivity*productivityStride
+  const size_t capitalStride = columnLayout ? 1 : nGridProductivity;
+  const size_t productivityStride = columnLayout ? nPaddedCapital : 1;
+
+  ///////////////////////////////////////////////////////////////////////////////////////////
+  // 2. Main iteration
+  ///////////////////////////////////////////////////////////////////////////////////////////
+
+  const double capitalSteadyState = model.capital_steady_state();
+  const double gridStep = model.grid_step();
+
+  // A checkpoint of this model, with the same grid and productivity process, replaces the
+  // warm start
+  const unsigned long long calibrationHash = model.calibration_hash();
+  CheckpointHeader resumeHeader;
+  const bool resumed = options.checkpointFile != NULL && options.resume &&
+    read_checkpoint(options.checkpointFile,resumeHeader,checkpoint) && resumeHeader.calibrationHash == calibrationHash;
+  if (resumed){
+    warmStart = &checkpoint;
+  }
+  else if (progress != NULL && options.checkpointFile != NULL && options.resume){
+    *progress <<"No checkpoint of this model in "<<options.checkpointFile<<", starting from the beginning\n";
+  }
+
+  if (warmStart != NULL && (warmStart->nGridCapital != nGridCapital || warmStart->nGridProductivity != nGridProductivity)){
+    warmStart = NULL;
+  }
+
+  // Multigrid: each level halves the number of grid intervals of the one above it, down to
+  // multigridMinPoints; a coarser grid is too far from the fine solution to warm-start it
+  // and costs iterations instead. A shared grid or a warm start leaves a single level.
+  const int multigridMinPoints = 128;
+  int nLevels = 1;
+  while (model.vGridCapitalShared == NULL && warmStart == NULL &&
+	 2 << (nLevels-1) <= options.coarsening && ((nGridCapital-1) >> nLevels)+1 >= multigridMinPoints){
+    ++nLevels;
+  }
+
+  // Memory traffic model, in bytes per state: every matrix a pass touches is counted once
+  // and nothing is assumed to stay in cache from one pass to the next. The fused sweep
+  // keeps the expected value and the columns being compared in cache.
+  const double expectationBytes = 16, maximizationBytes = 40, howardBytes = 28, returnBytes = 20, differenceBytes = 24, shiftBytes = 16;
+  double bytesMoved = 0.0;
+
+  int nCapital, nProductivity;
+  double maxDifference = 10.0, diffHighSoFar = 0.0, plainDifference = 0.0;
+  int iteration = 0, maximizations = 0, policyChanges = 0;
+  long evaluations = 0, cacheHits = 0;
+  bool cacheReady = false;
+  // Smallest and largest change of each part of the convergence pass
+  const int nParts = max(4*nThreads,nGridProductivity);
+  std::vector<double> partLow(nParts), partHigh(nParts);
+  double maximizationTime[2] = {0.0, 0.0};
+  int timedMaximizations[2] = {0, 0};
+
+  columns.resize(nGridProductivity);
+
+  // Levels of the multigrid, from the coarsest to the full grid
+  int nLevelCapital = 0;
+  double levelStep = 0.0;
+
+  for (int level = nLevels-1; level >= 0; --level){
+
+    const int nCoarseCapital = nLevelCapital;
+    const double coarseStep = levelStep;
+    nLevelCapital = ((nGridCapital-1) >> level)+1;
+    levelStep = (level == 0) ? gridStep : gridStep*(nGridCapital-1)/(nLevelCapital-1);
+
+    // We generate the grid of capital
+    for (nCapital = 0; nCapital < nLevelCapital; ++nCapital){
+      vGridCapital[nCapital] = (model.vGridCapitalShared != NULL) ? model.vGridCapitalShared[nCapital] :
+	model.lowerBound*capitalSteadyState+levelStep*nCapital;
+    }
+
+    // We pre-build output for each point in the grid
+
+    for (nProductivity = 0; nProductivity<nGridProductivity; ++nProductivity){
+      for (nCapital = 0; nCapital < nLevelCapital; ++nCapital){
+	mOutput[nCapital*capitalStride+nProductivity*productivityStride] = vProductivity[nProductivity]*pow(vGridCapital[nCapital],aalpha);
+      }
+    }
+
+    if (nCoarseCapital == 0){
+      for (nProductivity = 0; nProductivity<nGridProductivity; ++nProductivity){
+	for (nCapital = 0; nCapital < nLevelCapital; ++nCapital){
+	  mPolicyLow[nCapital*capitalStride+nProductivity*productivityStride] = 0;
+	  mPolicyHigh[nCapital*capitalStride+nProductivity*productivityStride] = nLevelCapital-1;
+	}
+      }
+    }
+    if (nCoarseCapital == 0 && warmStart != NULL){
+      for (nProductivity = 0; nProductivity<nGridProductivity; ++nProductivity){
+	for (nCapital = 0; nCapital < nLevelCapital; ++nCapital){
+	  const size_t nState = nCapital*capitalStride+nProductivity*productivityStride;
+	  mValueFunction[nState] = warmStart->value(nCapital,nProductivity);
+	  mPolicyIndex[nState] = warmStart->policy_index(nCapital,nProductivity);
+	  mPolicyFunction[nState] = vGridCapital[mPolicyIndex[nState]];
+	}
+      }
+    }
+    else if (nCoarseCapital > 0){
+      // Warm start: the value function and the policy of the coarser level are interpolated
+      // linearly onto this grid, and the policy index is bracketed by two coarse intervals
+      // on each side of the interpolated policy
+      memcpy(mValueFunctionNew,mValueFunction,nStates*sizeof(double));
+      const int margin = 2*(int)ceil(coarseStep/levelStep)+1;
+      for (nProductivity = 0; nProductivity<nGridProductivity; ++nProductivity){
+	for (nCapital = 0; nCapital < nLevelCapital; ++nCapital){
+	  const size_t nState = nCapital*capitalStride+nProductivity*productivityStride;
+	  const double position = levelStep*nCapital/coarseStep;
+	  const int nCoarse = min((int)position,nCoarseCapital-2);
+	  const size_t nCoarseState = nCoarse*capitalStride+nProductivity*productivityStride;
+	  const double weight = position-nCoarse;
+	  mValueFunction[nState] = (1-weight)*mValueFunctionNew[nCoarseState]+weight*mValueFunctionNew[nCoarseState+capitalStride];
+	  const double policy = (1-weight)*mPolicyFunction[nCoarseState]+weight*mPolicyFunction[nCoarseState+capitalStride];
+	  const int policyIndex = min(max((int)((policy-vGridCapital[0])/levelStep+0.5),0),nLevelCapital-1);
+	  mPolicyIndex[nState] = policyIndex;
+	  mPolicyLow[nState] = max(policyIndex-margin,0);
+	  mPolicyHigh[nState] = min(policyIndex+margin,nLevelCapital-1);
+	}
+      }
+    }
+
+    // The Howard schedule restarts on each level, which begins with a maximization. With the
+    // bounds the iterates differ from plain value function iteration by accumulatedShift.
+    maxDifference = 10.0;
+    int levelIteration = 0;
+    double accumulatedShift = 0.0;
+
+    // A resumed solve continues the counters and the Howard schedule of the checkpoint, or
+    // starts a new schedule with a maximization if the checkpoint had other Howard steps
+    if (resumed){
+      iteration = resumeHeader.iteration;
+      levelIteration = (resumeHeader.howardSteps == howardSteps) ? resumeHeader.levelIteration : 0;
+      maximizations = resumeHeader.maximizations;
+      evaluations = resumeHeader.evaluations;
+      accumulatedShift = resumeHeader.accumulatedShift;
+      bytesMoved = resumeHeader.bytesMoved;
+      for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+	for (nCapital = 0;nCapital<nLevelCapital;++nCapital){
+	  const size_t nState = nCapital*capitalStride+nProductivity*productivityStride;
+	  mPolicyReturn[nState] = (1-bbeta)*log(mOutput[nState]-vGridCapital[mPolicyIndex[nState]]);
+	}
+      }
+      if (progress != NULL){
+	*progress <<"Resuming from iteration "<<iteration<<" of "<<options.checkpointFile<<"\n";
+	if (resumeHeader.howardSteps != howardSteps){
+	  *progress <<"The checkpoint has "<<resumeHeader.howardSteps<<" Howard steps, restarting the schedule with "<<howardSteps<<"\n";
+	}
+      }
+    }
+
+    // A coarser level only has to be as close to its fixed point as the interpolation error
+    // of the warm start it gives; the tolerance triples per level
+    const double levelTolerance = tolerance*pow(3.0,level);
+    while (maxDifference>levelTolerance){
+
+      // In the fused sweep the expected value is computed inside the maximization and Howard
+      // passes, one column at a time, into the first column of expectedValueFunction
+      const double nLevelStates = (double)nLevelCapital*nGridProductivity;
+      diffHighSoFar = -100000.0;
+      double diffLow = DBL_MAX, diffHigh = -DBL_MAX;
+#ifdef RBC_INSTRUMENT
+      const std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+      std::chrono::steady_clock::time_point expectationEnd, maximizationEnd;
+      const long evaluationsBefore = evaluations;
+      long walkLengths[walkHistogramBins] = {0};
+#endif
+
+      if (fusedSweep){
+	bytesMoved += (levelIteration % howardSteps == 0 ? maximizationBytes : howardBytes)*nLevelStates;
+      }
+      else if (columnLayout){
+	// Product of the transition matrix with the columns of the value function
+	pool.run(nThreads,nGridProductivity,[&](int nColumn){
+	  expected_column(expectedValueFunction+nColumn*productivityStride,mValueFunction,expectation,nColumn,
+			  productivityStride,nLevelCapital);
+	});
+      }
+      else{
+	pool.run(nThreads,nGridProductivity,[&](int nColumn){
+	  expected_rows(expectedValueFunction+nColumn,mValueFunction,expectation,nColumn,
+			capitalStride,1,0,nLevelCapital);
+	});
+      }
+      if (!fusedSweep){
+	bytesMoved += (expectationBytes+(levelIteration % howardSteps == 0 ? maximizationBytes : howardBytes)+differenceBytes)*nLevelStates;
+      }
+#ifdef RBC_INSTRUMENT
+      expectationEnd = std::chrono::steady_clock::now();
+#endif
+
+      if (levelIteration % howardSteps == 0){
+
+	policyChanges = 0;
+	const std::chrono::steady_clock::time_point maximizationStart = std::chrono::steady_clock::now();
+
+	// The threaded walk computes every expected column before the threads start; the
+	// serial fused sweep shares one column of expectedValueFunction
+	for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+	  BellmanColumn& column = columns[nProductivity];
+	  const bool sharedExpected = fusedSweep && !threadedWalk;
+	  column.vGridCapital = vGridCapital;
+	  column.outputColumn = mOutput+nProductivity*productivityStride;
+	  column.expectedColumn = sharedExpected ? expectedValueFunction : expectedValueFunction+nProductivity*productivityStride;
+	  column.valueColumn = mValueFunctionNew+nProductivity*productivityStride;
+	  column.policyColumn = mPolicyFunction+nProductivity*productivityStride;
+	  column.policyIndexColumn = mPolicyIndex+nProductivity*productivityStride;
+	  column.policyLowColumn = mPolicyLow+nProductivity*productivityStride;
+	  column.policyHighColumn = mPolicyHigh+nProductivity*productivityStride;
+	  column.capitalStride = capitalStride;
+	  column.bbeta = bbeta;
+	  column.evaluations = 0;
+	  column.policyChanges = 0;
+	  column.lazyExpected = (double*)column.expectedColumn;
+	  column.valueFunction = mValueFunction;
+	  column.expectation = &expectation;
+	  column.nProductivity = nProductivity;
+	  column.productivityStride = productivityStride;
+	  column.nExpectedReady = nLevelCapital;
+	  column.utilityCache = cacheReady ? mUtility+nProductivity*productivityStride*cacheWidth : NULL;
+	  column.bandStartColumn = cacheReady ? mBandStart+nProductivity*productivityStride : NULL;
+	  column.cacheWidth = cacheWidth;
+	  column.cacheHits = 0;
+#ifdef RBC_INSTRUMENT
+	  memset(column.walkLengths,0,sizeof(column.walkLengths));
+#endif
+	}
+
+	if (threadedWalk){
+	  if (fusedSweep){
+	    pool.run(nThreads,nGridProductivity,[&](int nColumn){
+	      expected_rows(columns[nColumn].lazyExpected,mValueFunction,expectation,nColumn,1,productivityStride,0,nLevelCapital);
+	    });
+	  }
+	  threaded_walk(columns,nLevelCapital,nThreads,pool,previousIndex);
+	  if (fusedSweep){
+	    pool.run(nThreads,nGridProductivity,[&](int nColumn){
+	      partLow[nColumn] = DBL_MAX;
+	      partHigh[nColumn] = -DBL_MAX;
+	      fold_difference(columns[nColumn].valueColumn,mValueFunction+nColumn*productivityStride,nLevelCapital,
+			      partLow[nColumn],partHigh[nColumn]);
+	    });
+	    for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+	      diffLow = min(diffLow,partLow[nProductivity]);
+	      diffHigh = max(diffHigh,partHigh[nProductivity]);
+	    }
+	  }
+	}
+
+	for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+
+	  BellmanColumn& column = columns[nProductivity];
+
+	  if (!threadedWalk){
+	    // The walk computes the rows of the expected value as it reaches them; the other
+	    // engines need the whole column first
+	    if (fusedSweep && engine == scalarEngine){
+	      column.nExpectedReady = 0;
+	    }
+	    else if (fusedSweep){
+	      expected_rows(column.lazyExpected,mValueFunction,expectation,nProductivity,1,productivityStride,0,nLevelCapital);
+	    }
+
+	    if (engine == binaryEngine){
+	      binary_maximize(column,0,nLevelCapital-1,0,nLevelCapital-1);
+	    }
+#ifdef RBC_SIMD
+	    else if (engine == vectorEngine){
+	      column.policyChanges = vector_maximize(vGridCapital,column.outputColumn,column.expectedColumn,bbeta,nLevelCapital,
+						     column.valueColumn,column.policyColumn,column.policyIndexColumn,
+						     column.policyLowColumn,column.evaluations);
+	    }
+#endif
+	    else{
+	      walk_maximize(column,nLevelCapital,0,nLevelCapital,0);
+	    }
+	  }
+
+	  evaluations += column.evaluations;
+	  policyChanges += column.policyChanges;
+	  cacheHits += column.cacheHits;
+#ifdef RBC_INSTRUMENT
+	  for (int nBin = 0; nBin < walkHistogramBins; ++nBin){
+	    walkLengths[nBin] += column.walkLengths[nBin];
+	  }
+#endif
+	  if (fusedSweep && !threadedWalk){
+	    fold_difference(column.valueColumn,mValueFunction+nProductivity*productivityStride,nLevelCapital,diffLow,diffHigh);
+	  }
+	}
+
+	++maximizations;
+	maximizationTime[cacheReady] += std::chrono::duration<double>(std::chrono::steady_clock::now()-maximizationStart).count();
+	++timedMaximizations[cacheReady];
+
+	// The utility cache is built once, on the full grid, after the first maximization past
+	// the one that starts the level that changes fewer than 1% of the policies. The walk for a state goes from the policy of
+	// the state before it to one past its own, and the band is centred on that stretch.
+	if (cacheWidth > 0 && !cacheReady && level == 0 && levelIteration > 0 && policyChanges*100.0 <= nLevelStates){
+	  for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+	    for (nCapital = 0;nCapital<nLevelCapital;++nCapital){
+	      const size_t nState = nCapital*capitalStride+nProductivity*productivityStride;
+	      const int previous = (nCapital == 0) ? mPolicyIndex[nState] : mPolicyIndex[nState-capitalStride];
+	      const int walked = mPolicyIndex[nState]-previous+2;
+	      const int bandStart = max(0,min(previous-max(cacheWidth-walked,0)/2,nLevelCapital-cacheWidth));
+	      mBandStart[nState] = bandStart;
+	      for (int nBand = 0; nBand < cacheWidth; ++nBand){
+		const double consumption = mOutput[nState]-vGridCapital[bandStart+nBand];
+		mUtility[nState*cacheWidth+nBand] = (1-bbeta)*log(consumption);
+	      }
+	    }
+	  }
+	  cacheReady = true;
+	}
+
+	if (howardSteps > 1){
+	  bytesMoved += returnBytes*nLevelStates;
+	  for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+	    for (nCapital = 0;nCapital<nLevelCapital;++nCapital){
+	      const size_t nState = nCapital*capitalStride+nProductivity*productivityStride;
+	      const double consumption = mOutput[nState]-vGridCapital[mPolicyIndex[nState]];
+	      mPolicyReturn[nState] = (1-bbeta)*log(consumption);
+	    }
+	  }
+	}
+
+      }
+      else{
+
+	// Howard step: apply the policy found at the last maximization
+	for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+	  if (fusedSweep){
+	    expected_rows(expectedValueFunction,mValueFunction,expectation,nProductivity,1,productivityStride,0,nLevelCapital);
+	    for (nCapital = 0;nCapital<nLevelCapital;++nCapital){
+	      const size_t nState = nCapital+nProductivity*productivityStride;
+	      mValueFunctionNew[nState] = mPolicyReturn[nState]+bbeta*expectedValueFunction[mPolicyIndex[nState]];
+	    }
+	    fold_difference(mValueFunctionNew+nProductivity*productivityStride,mValueFunction+nProductivity*productivityStride,nLevelCapital,diffLow,diffHigh);
+	    continue;
+	  }
+	  for (nCapital = 0;nCapital<nLevelCapital;++nCapital){
+	    const size_t nState = nCapital*capitalStride+nProductivity*productivityStride;
+	    mValueFunctionNew[nState] = mPolicyReturn[nState]+bbeta*expectedValueFunction[mPolicyIndex[nState]*capitalStride+nProductivity*productivityStride];
+	  }
+	}
+
+      }
+
+#ifdef RBC_INSTRUMENT
+      maximizationEnd = std::chrono::steady_clock::now();
+#endif
+
+      // Padding entries are zero in both matrices and do not affect the sup norm. The fused
+      // sweep has folded the differences already and swaps the buffers instead of copying.
+      // The other passes split the states into parts, whose extremes are exact whatever the
+      // number of threads.
+      if (fusedSweep){
+	diffHighSoFar = max(diffHigh,-diffLow);
+	double* valueFunction = mValueFunction;
+	mValueFunction = mValueFunctionNew;
+	mValueFunctionNew = valueFunction;
+      }
+      else if (!boundsConvergence){
+	const int nStateParts = (nThreads == 1) ? 1 : 4*nThreads;
+	pool.run(nThreads,nStateParts,[&](int nPart){
+	  double partMax = -100000.0;
+	  for (size_t nState = nStates*nPart/nStateParts; nState < nStates*(nPart+1)/nStateParts; ++nState){
+	    const double diff = std::abs(mValueFunction[nState]-mValueFunctionNew[nState]);
+	    if (diff>partMax){
+	      partMax = diff;
+	    }
+	    mValueFunction[nState] = mValueFunctionNew[nState];
+	  }
+	  partHigh[nPart] = partMax;
+	});
+	for (int nPart = 0; nPart < nStateParts; ++nPart){
+	  diffHighSoFar = max(diffHighSoFar,partHigh[nPart]);
+	}
+      }
+      else{
+	// The bounds need the smallest and largest change over the grid, without the padding
+	pool.run(nThreads,nGridProductivity,[&](int nColumn){
+	  double partMin = DBL_MAX, partMax = -DBL_MAX;
+	  for (int nRow = 0;nRow<nLevelCapital;++nRow){
+	    const size_t nState = nRow*capitalStride+nColumn*productivityStride;
+	    const double diff = mValueFunctionNew[nState]-mValueFunction[nState];
+	    partMin = min(partMin,diff);
+	    partMax = max(partMax,diff);
+	    mValueFunction[nState] = mValueFunctionNew[nState];
+	  }
+	  partLow[nColumn] = partMin;
+	  partHigh[nColumn] = partMax;
+	});
+	for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+	  diffLow = min(diffLow,partLow[nProductivity]);
+	  diffHigh = max(diffHigh,partHigh[nProductivity]);
+	}
+	diffHighSoFar = max(diffHigh,-diffLow);
+      }
+      plainDifference = diffHighSoFar;
+
+      // Only a maximization step measures the distance to the Bellman fixed point. With
+      // Howard steps the value function lags the policy, so we also require a stable policy
+      // on the full grid. A coarser level only warm-starts the next one, and waiting there
+      // for the last policies to settle costs more iterations than it saves.
+      const bool stablePolicy = policyChanges == 0 || level > 0;
+      if (levelIteration % howardSteps == 0 && !boundsConvergence){
+	maxDifference = (howardSteps > 1 && !stablePolicy) ? max(diffHighSoFar,10.0*tolerance) : diffHighSoFar;
+      }
+      else if (levelIteration % howardSteps == 0){
+	// MacQueen-Porteus: the fixed point lies between V+bbeta/(1-bbeta)*diffLow and
+	// V+bbeta/(1-bbeta)*diffHigh. We move V to the middle of the bounds, which shifts every
+	// later iterate by a constant and leaves the policies unchanged.
+	const double shift = bbeta/(1-bbeta)*0.5*(diffLow+diffHigh);
+	bytesMoved += shiftBytes*nLevelStates;
+	for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+	  for (nCapital = 0;nCapital<nLevelCapital;++nCapital){
+	    mValueFunction[nCapital*capitalStride+nProductivity*productivityStride] += shift;
+	  }
+	}
+	plainDifference = max(std::abs(diffLow+(1-bbeta)*accumulatedShift),std::abs(diffHigh+(1-bbeta)*accumulatedShift));
+	accumulatedShift = bbeta*accumulatedShift+shift;
+	const double boundGap = bbeta/(1-bbeta)*(diffHigh-diffLow);
+	maxDifference = stablePolicy ? boundGap : max(boundGap,10.0*tolerance);
+      }
+
+#ifdef RBC_INSTRUMENT
+      if (options.trace != NULL){
+	const std::chrono::steady_clock::time_point convergenceEnd = std::chrono::steady_clock::now();
+	*options.trace <<"{\"iteration\":"<<iteration+1<<",\"gridPoints\":"<<nLevelCapital
+		       <<",\"step\":\""<<(levelIteration % howardSteps == 0 ? "maximization" : "howard")<<"\""
+		       <<",\"expectationSeconds\":"<<std::chrono::duration<double>(expectationEnd-phaseStart).count()
+		       <<",\"maximizationSeconds\":"<<std::chrono::duration<double>(maximizationEnd-expectationEnd).count()
+		       <<",\"convergenceSeconds\":"<<std::chrono::duration<double>(convergenceEnd-maximizationEnd).count()
+		       <<",\"evaluations\":"<<evaluations-evaluationsBefore
+		       <<",\"evaluationsPerState\":"<<(evaluations-evaluationsBefore)/nLevelStates
+		       <<",\"walkLengths\":[";
+	for (int nBin = 0; nBin < walkHistogramBins; ++nBin){
+	  *options.trace <<(nBin > 0 ? "," : "")<<walkLengths[nBin];
+	}
+	*options.trace <<"]}\n";
+      }
+#endif
+
+      iteration = iteration+1;
+      levelIteration = levelIteration+1;
+      if (progress != NULL && (iteration % 10 == 0 || iteration ==1)){
+	*progress <<"Iteration = "<<iteration<<", Sup Diff = "<<diffHighSoFar<<"\n";
+      }
+
+      if (options.checkpointFile != NULL && options.checkpointInterval > 0 && level == 0 &&
+	  iteration % options.checkpointInterval == 0 && maxDifference > levelTolerance){
+	CheckpointHeader header;
+	memcpy(header.magic,checkpointMagic,sizeof(checkpointMagic));
+	header.calibrationHash = calibrationHash;
+	header.nGridCapital = nGridCapital;
+	header.nGridProductivity = nGridProductivity;
+	header.iteration = iteration;
+	header.levelIteration = levelIteration;
+	header.maximizations = maximizations;
+	header.howardSteps = howardSteps;
+	header.evaluations = evaluations;
+	header.accumulatedShift = accumulatedShift;
+	header.bytesMoved = bytesMoved;
+	checkpoint.mValueFunction.resize((size_t)nGridCapital*nGridProductivity);
+	checkpoint.mPolicyIndex.resize((size_t)nGridCapital*nGridProductivity);
+	for (nCapital = 0;nCapital<nGridCapital;++nCapital){
+	  for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+	    const size_t nState = nCapital*capitalStride+nProductivity*productivityStride;
+	    checkpoint.mValueFunction[nCapital*nGridProductivity+nProductivity] = mValueFunction[nState];
+	    checkpoint.mPolicyIndex[nCapital*nGridProductivity+nProductivity] = mPolicyIndex[nState];
+	  }
+	}
+	write_checkpoint(options.checkpointFile,header,checkpoint);
+      }
+    }
+
+    if (progress != NULL && nLevels > 1){
+      *progress <<"Grid points = "<<nLevelCapital<<", Iterations = "<<iteration<<"\n";
+    }
+  }
+
+  ///////////////////////////////////////////////////////////////////////////////////////////
+  // 3. Solution
+  ///////////////////////////////////////////////////////////////////////////////////////////
+
+  Solution& solution = solution_;
+  solution.nGridCapital = nGridCapital;
+  solution.nGridProductivity = nGridProductivity;
+  solution.vGridCapital.assign(vGridCapital,vGridCapital+nGridCapital);
+  solution.mValueFunction.resize((size_t)nGridCapital*nGridProductivity);
+  solution.mPolicyFunction.resize((size_t)nGridCapital*nGridProductivity);
+  solution.mPolicyIndex.resize((size_t)nGridCapital*nGridProductivity);
+  for (nCapital = 0;nCapital<nGridCapital;++nCapital){
+    for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
+      const size_t nState = nCapital*capitalStride+nProductivity*productivityStride;
+      solution.mValueFunction[nCapital*nGridProductivity+nProductivity] = mValueFunction[nState];
+      solution.mPolicyFunction[nCapital*nGridProductivity+nProductivity] = mPolicyFunction[nState];
+      solution.mPolicyIndex[nCapital*nGridProductivity+nProductivity] = mPolicyIndex[nState];
+    }
+  }
+  solution.iterations = iteration;
+  solution.maximizations = maximizations;
+  solution.evaluations = evaluations;
+  solution.supDiff = maxDifference;
+  solution.plainDifference = plainDifference;
+  solution.bytesPerIteration = bytesMoved/iteration;
+  solution.utilityCacheBytes = cacheBytes;
+  solution.utilityCacheWidth = cacheWidth;
+  solution.expectationKernel = expectation.kernel;
+  solution.resumedIteration = resumed ? resumeHeader.iteration : 0;
+  solution.cacheHits = cacheHits;
+  solution.uncachedMaximizationTime = (timedMaximizations[0] > 0) ? maximizationTime[0]/timedMaximizations[0] : 0.0;
+  solution.cachedMaximizationTime = (timedMaximizations[1] > 0) ? maximizationTime[1]/timedMaximizations[1] : 0.0;
+
+  return solution;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Endogenous grid method
+///////////////////////////////////////////////////////////////////////////////////////////
+
+// Endogenous grid method (Carroll, 2006) for this model: with log utility and full
+// depreciation the Euler equation
+//   1/c(k,z) = bbeta * sum over z' of P(z,z') * aalpha*z'*k'^(aalpha-1) / c(k',z')
+// gives, for each capital k' chosen on the grid, the consumption and so the output
+// z*k^aalpha = c+k' of the state that chooses it, with no maximization. Each iteration
+// inverts those pairs to k'(k) on vGridCapital by linear interpolation (the choice stays
+// inside the grid, as in grid search) and stops when k' moves less than tolerance. The value
+// function is then that of the policy, iterated to tolerance with the value of each choice
+// interpolated between grid points.
+//
+// The policy function holds k' between grid points, and the policy indices the nearest
+// grid point. evaluations is 0 and each iteration counts as one maximization.
+inline const Solution& Solver::solve_egm(const Model& model, const Options& options){
+
+  const double aalpha = model.aalpha, bbeta = model.bbeta;
+  const int nGridCapital = model.nGridCapital, nGridProductivity = model.productivity_states();
+  const double* vProductivity = &model.vProductivity[0];
+  const double* mTransition = &model.mTransition[0];
+  const size_t nStates = (size_t)nGridCapital*nGridProductivity;
+  std::ostream* progress = options.progress;
+
+  Solution& solution = solution_;
+  solution = Solution();
+  solution.nGridCapital = nGridCapital;
+  solution.nGridProductivity = nGridProductivity;
+  std::vector<double>& vGridCapital = solution.vGridCapital;
+  vGridCapital.resize(nGridCapital);
+  for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+    vGridCapital[nCapital] = (model.vGridCapitalShared != NULL) ? model.vGridCapitalShared[nCapital] :
+      model.lowerBound*model.capital_steady_state()+model.grid_step()*nCapital;
+  }
+
+  // Element (nCapital,nProductivity) at nCapital*nGridProductivity+nProductivity, as in Solution
+  std::vector<double> mOutput(nStates), mConsumption(nStates);
+  std::vector<double>& mPolicyFunction = solution.mPolicyFunction;
+  mPolicyFunction.assign(nStates,vGridCapital[0]);
+  std::vector<double> vMarginalProduct(nGridCapital), vEndogenousCapital(nGridCapital);
+  for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+    vMarginalProduct[nCapital] = aalpha*pow(vGridCapital[nCapital],aalpha-1);
+    for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+      mOutput[nCapital*nGridProductivity+nProductivity] = vProductivity[nProductivity]*pow(vGridCapital[nCapital],aalpha);
+    }
+  }
+  // Consumption of the lowest choice to start
+  for (size_t nState = 0; nState < nStates; ++nState){
+    mConsumption[nState] = mOutput[nState]-mPolicyFunction[nState];
+  }
+
+  double maxDifference = 10.0;
+  int iteration = 0;
+  while (maxDifference > options.tolerance){
+    maxDifference = 0.0;
+    for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+
+      // The state on the endogenous grid that chooses each k'
+      for (int nCapitalNextPeriod = 0; nCapitalNextPeriod < nGridCapital; ++nCapitalNextPeriod){
+	double expectedMarginalValue = 0.0;
+	for (int nProductivityNextPeriod = 0; nProductivityNextPeriod < nGridProductivity; ++nProductivityNextPeriod){
+	  expectedMarginalValue += mTransition[nProductivity*nGridProductivity+nProductivityNextPeriod]*vProductivity[nProductivityNextPeriod]/
+	    mConsumption[nCapitalNextPeriod*nGridProductivity+nProductivityNextPeriod];
+	}
+	const double consumption = 1.0/(bbeta*vMarginalProduct[nCapitalNextPeriod]*expectedMarginalValue);
+	vEndogenousCapital[nCapitalNextPeriod] = pow((consumption+vGridCapital[nCapitalNextPeriod])/vProductivity[nProductivity],1/aalpha);
+      }
+
+      // Back onto the grid: the endogenous grid rises with k', so one pass finds every bracket
+      int nBracket = 0;
+      for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+	const size_t nState = nCapital*nGridProductivity+nProductivity;
+	const double capital = vGridCapital[nCapital];
+	double policy;
+	if (capital <= vEndogenousCapital[0]){
+	  policy = vGridCapital[0];
+	}
+	else if (capital >= vEndogenousCapital[nGridCapital-1]){
+	  policy = vGridCapital[nGridCapital-1];
+	}
+	else{
+	  while (vEndogenousCapital[nBracket+1] < capital){
+	    ++nBracket;
+	  }
+	  const double weight = (capital-vEndogenousCapital[nBracket])/(vEndogenousCapital[nBracket+1]-vEndogenousCapital[nBracket]);
+	  policy = (1-weight)*vGridCapital[nBracket]+weight*vGridCapital[nBracket+1];
+	}
+	maxDifference = max(maxDifference,std::abs(policy-mPolicyFunction[nState]));
+	mPolicyFunction[nState] = policy;
+      }
+    }
+    for (size_t nState = 0; nState < nStates; ++nState){
+      mConsumption[nState] = mOutput[nState]-mPolicyFunction[nState];
+    }
+
+    ++iteration;
+    if (progress != NULL && (iteration % 10 == 0 || iteration ==1)){
+      *progress <<"Iteration = "<<iteration<<", Sup Diff = "<<maxDifference<<"\n";
+    }
+  }
+
+  // Nearest grid point, and the bracket and weight that interpolate the value of each choice
+  std::vector<int>& mPolicyIndex = solution.mPolicyIndex;
+  std::vector<int> mBracket(nStates);
+  std::vector<double> mWeight(nStates), mReturn(nStates);
+  mPolicyIndex.resize(nStates);
+  const double gridStep = (vGridCapital[nGridCapital-1]-vGridCapital[0])/(nGridCapital-1);
+  for (size_t nState = 0; nState < nStates; ++nState){
+    const int nBracket = min(max((int)((mPolicyFunction[nState]-vGridCapital[0])/gridStep),0),nGridCapital-2);
+    mBracket[nState] = nBracket;
+    mWeight[nState] = min(max((mPolicyFunction[nState]-vGridCapital[nBracket])/(vGridCapital[nBracket+1]-vGridCapital[nBracket]),0.0),1.0);
+    mPolicyIndex[nState] = nBracket+(mWeight[nState] >= 0.5);
+    mReturn[nState] = (1-bbeta)*log(mConsumption[nState]);
+  }
+
+  // Value of the policy
+  std::vector<double>& mValueFunction = solution.mValueFunction;
+  std::vector<double> mValueFunctionNew(nStates);
+  mValueFunction.assign(nStates,0.0);
+  double valueDifference = 10.0;
+  while (valueDifference > options.tolerance){
+    valueDifference = 0.0;
+    for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+      for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+	const size_t nState = nCapital*nGridProductivity+nProductivity;
+	const double* low = &mValueFunction[mBracket[nState]*nGridProductivity];
+	const double* high = low+nGridProductivity;
+	double expectedValue = 0.0;
+	for (int nProductivityNextPeriod = 0; nProductivityNextPeriod < nGridProductivity; ++nProductivityNextPeriod){
+	  expectedValue += mTransition[nProductivity*nGridProductivity+nProductivityNextPeriod]*
+	    ((1-mWeight[nState])*low[nProductivityNextPeriod]+mWeight[nState]*high[nProductivityNextPeriod]);
+	}
+	mValueFunctionNew[nState] = mReturn[nState]+bbeta*expectedValue;
+	valueDifference = max(valueDifference,std::abs(mValueFunctionNew[nState]-mValueFunction[nState]));
+      }
+    }
+    mValueFunction.swap(mValueFunctionNew);
+  }
+
+  solution.iterations = iteration;
+  solution.maximizations = iteration;
+  solution.supDiff = maxDifference;
+  solution.plainDifference = maxDifference;
+  solution.bytesPerIteration = (double)nStates*(3*sizeof(double)+nGridProductivity*sizeof(double));
+  return solution;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Continuous choice
+///////////////////////////////////////////////////////////////////////////////////////////
+
+// Shape-preserving cubic spline (Fritsch and Carlson, 1980) through nPoints values on the
+// evenly spaced points x0, x0+step, ...: on interval i it is a+t*(b+t*(c+t*d)) with
+// t = x-x0-i*step, and it is monotone wherever the data are
+struct MonotoneSpline{
+  double x0, step;
+  int nPoints;
+  std::vector<double> a, b, c, d, secant, slope;
+
+  // Three passes over the data (n >= 3): the secant slopes of the n-1 intervals; the slopes
+  // at the points, the harmonic mean of neighbouring secants inside (zero at a local
+  // extremum), which keeps each interval monotone without a separate limiter, and the
+  // one-sided three-point slope at the ends, limited as in pchip; and the cubic coefficients
+  // of each interval. Selects rather than branches, so the loops vectorize.
+  void build(const double* y, int n, double first, double spacing){
+    x0 = first;
+    step = spacing;
+    nPoints = n;
+    a.resize(n-1);
+    b.resize(n-1);
+    c.resize(n-1);
+    d.resize(n-1);
+    secant.resize(n-1);
+    slope.resize(n);
+    for (int i = 0; i < n-1; ++i){
+      secant[i] = (y[i+1]-y[i])/spacing;
+    }
+    for (int i = 1; i < n-1; ++i){
+      const double product = secant[i-1]*secant[i];
+      slope[i] = (product > 0.0) ? 2*product/(secant[i-1]+secant[i]) : 0.0;
+    }
+    slope[0] = end_slope(secant[0],secant[1]);
+    slope[n-1] = end_slope(secant[n-2],secant[n-3]);
+    for (int i = 0; i < n-1; ++i){
+      a[i] = y[i];
+      b[i] = slope[i];
+      c[i] = (3*secant[i]-2*slope[i]-slope[i+1])/spacing;
+      d[i] = (slope[i]+slope[i+1]-2*secant[i])/(spacing*spacing);
+    }
+  }
+
+  // Slope at an end from the secants of the two intervals next to it
+  static double end_slope(double nearSecant, double farSecant){
+    const double endSlope = (3*nearSecant-farSecant)/2;
+    if (endSlope*nearSecant <= 0.0){
+      return 0.0;
+    }
+    return (nearSecant*farSecant < 0.0 && std::abs(endSlope) > 3*std::abs(nearSecant)) ? 3*nearSecant : endSlope;
+  }
+
+  double operator()(double x) const {
+    const int i = min(max((int)((x-x0)/step),0),nPoints-2);
+    const double t = x-x0-i*step;
+    return a[i]+t*(b[i]+t*(c[i]+t*d[i]));
+  }
+};
+
+// Maximum of the value of choosing capitalChoice with output in [low,high] by Brent's method
+// (golden sections with parabolic steps) to within tolerance; the value is concave in the
+// choice, so the search is bracketed by the interval. Returns the choice and sets value,
+// adding the objective evaluations to evaluations.
+inline double brent_maximize(const MonotoneSpline& expectedValue, double output, double bbeta, double low, double high,
+			     double tolerance, double& value, long& evaluations){
+  const double golden = 0.3819660112501051;
+  const auto objective = [&](double capitalChoice){
+    ++evaluations;
+    return -((1-bbeta)*log(output-capitalChoice)+bbeta*expectedValue(capitalChoice));
+  };
+  double x = low+golden*(high-low), w = x, v = x;
+  double fx = objective(x), fw = fx, fv = fx;
+  double step = 0.0, lastStep = 0.0;
+  for (int nIteration = 0; nIteration < 200; ++nIteration){
+    const double middle = (low+high)/2, tolerance1 = tolerance+1e-12*std::abs(x), tolerance2 = 2*tolerance1;
+    if (std::abs(x-middle) <= tolerance2-(high-low)/2){
+      break;
+    }
+    bool parabolic = false;
+    if (std::abs(lastStep) > tolerance1){
+      const double r = (x-w)*(fx-fv), q0 = (x-v)*(fx-fw);
+      double p = (x-v)*q0-(x-w)*r, q = 2*(q0-r);
+      if (q > 0.0){
+	p = -p;
+      }
+      q = std::abs(q);
+      if (std::abs(p) < std::abs(0.5*q*lastStep) && p > q*(low-x) && p < q*(high-x)){
+	lastStep = step;
+	step = p/q;
+	parabolic = true;
+	if (x+step-low < tolerance2 || high-(x+step) < tolerance2){
+	  step = (middle >= x) ? tolerance1 : -tolerance1;
+	}
+      }
+    }
+    if (!parabolic){
+      lastStep = (x >= middle) ? low-x : high-x;
+      step = golden*lastStep;
+    }
+    const double u = (std::abs(step) >= tolerance1) ? x+step : x+((step > 0) ? tolerance1 : -tolerance1);
+    const double fu = objective(u);
+    if (fu <= fx){
+      (u >= x ? low : high) = x;
+      v = w; fv = fw;
+      w = x; fw = fx;
+      x = u; fx = fu;
+    }
+    else{
+      (u < x ? low : high) = u;
+      if (fu <= fw || w == x){
+	v = w; fv = fw;
+	w = u; fw = fu;
+      }
+      else if (fu <= fv || v == x || v == w){
+	v = u; fv = fu;
+      }
+    }
+  }
+  value = -fx;
+  return x;
+}
+
+// Value function iteration with continuous choices on a coarse grid of splineGridPoints
+// between the bounds of the model's grid. Each iteration fits a shape-preserving spline to
+// the expected value of each productivity state and finds each choice by Brent's method
+// between the choice of the state below (the policy is monotone) and the largest capital
+// with positive consumption. After convergence one more maximization with the same splines
+// gives the value and policy at every point of the model's grid, so the solution is on
+// vGridCapital like the others; the policy lies between grid points and the policy indices
+// are the nearest points. Matrices are stored by productivity state.
+inline const Solution& Solver::solve_spline(const Model& model, const Options& options){
+
+  const double aalpha = model.aalpha, bbeta = model.bbeta;
+  const int nGridCapital = model.nGridCapital, nGridProductivity = model.productivity_states();
+  const int nCoarseCapital = max(options.splineGridPoints,3);
+  const double* vProductivity = &model.vProductivity[0];
+  const double* mTransition = &model.mTransition[0];
+  std::ostream* progress = options.progress;
+  const double choiceTolerance = 1e-10;
+
+  Solution& solution = solution_;
+  solution = Solution();
+  solution.nGridCapital = nGridCapital;
+  solution.nGridProductivity = nGridProductivity;
+  std::vector<double>& vGridCapital = solution.vGridCapital;
+  vGridCapital.resize(nGridCapital);
+  for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+    vGridCapital[nCapital] = (model.vGridCapitalShared != NULL) ? model.vGridCapitalShared[nCapital] :
+      model.lowerBound*model.capital_steady_state()+model.grid_step()*nCapital;
+  }
+  const double lowestCapital = vGridCapital[0], highestCapital = vGridCapital[nGridCapital-1];
+  const double coarseStep = (highestCapital-lowestCapital)/(nCoarseCapital-1);
+
+  std::vector<double> vCoarseCapital(nCoarseCapital), mOutput((size_t)nCoarseCapital*nGridProductivity);
+  std::vector<double> mValueFunction(mOutput.size(),0.0), mValueFunctionNew(mOutput.size()), expectedColumn(nCoarseCapital);
+  std::vector<MonotoneSpline> splines(nGridProductivity);
+  for (int nCapital = 0; nCapital < nCoarseCapital; ++nCapital){
+    vCoarseCapital[nCapital] = lowestCapital+coarseStep*nCapital;
+    for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+      mOutput[nProductivity*nCoarseCapital+nCapital] = vProductivity[nProductivity]*pow(vCoarseCapital[nCapital],aalpha);
+    }
+  }
+
+  // Expected value of each productivity state and its spline
+  const auto build_splines = [&](){
+    for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+      std::fill(expectedColumn.begin(),expectedColumn.end(),0.0);
+      for (int nProductivityNextPeriod = 0; nProductivityNextPeriod < nGridProductivity; ++nProductivityNextPeriod){
+	const double probability = mTransition[nProductivity*nGridProductivity+nProductivityNextPeriod];
+	const double* valueColumn = &mValueFunction[nProductivityNextPeriod*nCoarseCapital];
+	for (int nCapital = 0; probability != 0.0 && nCapital < nCoarseCapital; ++nCapital){
+	  expectedColumn[nCapital] += probability*valueColumn[nCapital];
+	}
+      }
+      splines[nProductivity].build(&expectedColumn[0],nCoarseCapital,lowestCapital,coarseStep);
+    }
+  };
+
+  long evaluations = 0;
+  double maxDifference = 10.0;
+  int iteration = 0;
+  while (maxDifference > options.tolerance){
+    build_splines();
+    maxDifference = 0.0;
+    for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+      double capitalChoice = lowestCapital;
+      for (int nCapital = 0; nCapital < nCoarseCapital; ++nCapital){
+	const size_t nState = nProductivity*nCoarseCapital+nCapital;
+	const double high = min(highestCapital,mOutput[nState]-1e-12);
+	double value;
+	capitalChoice = brent_maximize(splines[nProductivity],mOutput[nState],bbeta,min(capitalChoice,high),high,
+				       choiceTolerance,value,evaluations);
+	mValueFunctionNew[nState] = value;
+	maxDifference = max(maxDifference,std::abs(value-mValueFunction[nState]));
+      }
+    }
+    mValueFunction.swap(mValueFunctionNew);
+
+    ++iteration;
+    if (progress != NULL && (iteration % 10 == 0 || iteration ==1)){
+      *progress <<"Iteration = "<<iteration<<", Sup Diff = "<<maxDifference<<"\n";
+    }
+  }
+
+  // The model's grid, with the splines of the converged value function
+  build_splines();
+  const size_t nStates = (size_t)nGridCapital*nGridProductivity;
+  solution.mValueFunction.resize(nStates);
+  solution.mPolicyFunction.resize(nStates);
+  solution.mPolicyIndex.resize(nStates);
+  for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+    double capitalChoice = lowestCapital;
+    for (int nCapital = 0; nCapital < nGridCapital; ++nCapital){
+      const size_t nState = nCapital*nGridProductivity+nProductivity;
+      const double output = vProductivity[nProductivity]*pow(vGridCapital[nCapital],aalpha);
+      const double high = min(highestCapital,output-1e-12);
+      double value;
+      capitalChoice = brent_maximize(splines[nProductivity],output,bbeta,min(capitalChoice,high),high,choiceTolerance,value,evaluations);
+      solution.mValueFunction[nState] = value;
+      solution.mPolicyFunction[nState] = capitalChoice;
+      const int nNearest = (int)((capitalChoice-lowestCapital)/(highestCapital-lowestCapital)*(nGridCapital-1)+0.5);
+      solution.mPolicyIndex[nState] = min(max(nNearest,0),nGridCapital-1);
+    }
+  }
+
+  solution.iterations = iteration;
+  solution.maximizations = iteration+1;
+  solution.evaluations = evaluations;
+  solution.supDiff = maxDifference;
+  solution.plainDifference = maxDifference;
+  solution.bytesPerIteration = (double)nCoarseCapital*nGridProductivity*(3+nGridProductivity+5)*sizeof(double);
+  return solution;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Parameter sweep
+///////////////////////////////////////////////////////////////////////////////////////////
+
+// Solves every model of a sweep on nThreads threads, each with its own Solver. The models
+// are split into one contiguous range per thread; a thread solves its range in order and
+// starts each model from the solution of the one before it, so neighbouring calibrations
+// warm-start each other. A thread that runs out of work steals the back half of the largest
+// remaining range and starts that one cold. report(nModel, solution, warm) is called by
+// the solving thread after each model, while the solution is still valid. The models are not
+// checkpointed.
+inline void solve_sweep(const std::vector<Model>& models, const Options& sweepOptions, int nThreads,
+			const std::function<void(int, const Solution&, bool)>& report){
+
+  struct Range{
+    std::mutex lock;
+    int begin, end;
+  };
+
+  Options options = sweepOptions;
+  options.checkpointFile = NULL;
+
+  const int nModels = (int)models.size();
+  nThreads = max(1,min(nThreads,nModels));
+  std::vector<Range> ranges(nThreads);
+  for (int nThread = 0; nThread < nThreads; ++nThread){
+    ranges[nThread].begin = (int)((long)nModels*nThread/nThreads);
+    ranges[nThread].end = (int)((long)nModels*(nThread+1)/nThreads);
+  }
+
+  const auto worker = [&](int nThread){
+    Solver solver;
+    Range& own = ranges[nThread];
+    int previous = -2;
+    for (;;){
+      int nModel = -1;
+      {
+	std::lock_guard<std::mutex> guard(own.lock);
+	if (own.begin < own.end){
+	  nModel = own.begin++;
+	}
+      }
+      if (nModel < 0){
+	// Steal the back half of the largest range left
+	int victim = -1, largest = 0;
+	for (int nOther = 0; nOther < nThreads; ++nOther){
+	  std::lock_guard<std::mutex> guard(ranges[nOther].lock);
+	  if (ranges[nOther].end-ranges[nOther].begin > largest){
+	    largest = ranges[nOther].end-ranges[nOther].begin;
+	    victim = nOther;
+	  }
+	}
+	if (victim < 0){
+	  return;
+	}
+	std::lock(own.lock,ranges[victim].lock);
+	std::lock_guard<std::mutex> ownGuard(own.lock,std::adopt_lock);
+	std::lock_guard<std::mutex> victimGuard(ranges[victim].lock,std::adopt_lock);
+	const int remaining = ranges[victim].end-ranges[victim].begin;
+	if (remaining <= 0){
+	  continue;
+	}
+	own.end = ranges[victim].end;
+	own.begin = ranges[victim].end-(remaining+1)/2;
+	ranges[victim].end = own.begin;
+	nModel = own.begin++;
+      }
+      const bool warm = (nModel == previous+1);
+      const Solution& solution = solver.solve(models[nModel],options,warm ? &solver.solution() : NULL);
+      report(nModel,solution,warm);
+      previous = nModel;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int nThread = 1; nThread < nThreads; ++nThread){
+    workers.push_back(std::thread(worker,nThread));
+  }
+  worker(0);
+  for (size_t nThread = 0; nThread < workers.size(); ++nThread){
+    workers[nThread].join();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// Euler equation errors
+///////////////////////////////////////////////////////////////////////////////////////////
+
+struct EulerErrorOptions{
+  int densePoints;                  // Capital points of the off-grid set, or 0 for none
+  int nThreads;
+
+  EulerErrorOptions() : densePoints(10000), nThreads(1) {}
+};
+
+// Unit-free Euler equation errors (Judd, 1992), log10 |1-c*/c| with c* the consumption the
+// Euler equation implies for the policy's choice: -5 is an error of a dollar for each
+// 100000 consumed. A state with no positive consumption counts as 0 (all of it).
+struct EulerErrorSummary{
+  long states;
+  double maxError, meanError;       // Mean of the log10 errors
+  double percentile50, percentile90, percentile99;
+};
+
+struct EulerErrors{
+  EulerErrorSummary grid;           // Every state of the grid
+  EulerErrorSummary dense;          // densePoints capital points strictly between the ends of the grid, each productivity state
+  double seconds;
+};
+
+namespace euler_detail {
+
+// Policy between the points of the evenly spaced grid, for every productivity state at once
+// from the row of the solution: the bracket index and weight of capital
+inline void bracket(const Solution& solution, double capital, int& nBracket, double& weight){
+  const int nGridCapital = solution.nGridCapital;
+  const double first = solution.vGridCapital[0], step = (solution.vGridCapital[nGridCapital-1]-first)/(nGridCapital-1);
+  nBracket = min(max((int)((capital-first)/step),0),nGridCapital-2);
+  weight = (capital-solution.vGridCapital[nBracket])/(solution.vGridCapital[nBracket+1]-solution.vGridCapital[nBracket]);
+}
+
+// Errors of the states with the given capital, policy and consumption in productivity state
+// nProductivity. The policy of each state is interpolated at its choice first, and the sum
+// over next period's productivity is then a loop without branches or calls, which the
+// compiler vectorizes across the states.
+inline void block_errors(const Model& model, const Solution& solution, int nProductivity, int nStates,
+			 const double* vPolicy, const double* vConsumption, double* vErrors){
+  const int nGridProductivity = solution.nGridProductivity;
+  const double aalpha = model.aalpha, bbeta = model.bbeta;
+  const int blockStates = 256;
+  int vBracket[blockStates];
+  double vWeight[blockStates], vOutputFactor[blockStates], vExpected[blockStates];
+  for (int nBegin = 0; nBegin < nStates; nBegin += blockStates){
+    const int nBlock = min(blockStates,nStates-nBegin);
+    for (int n = 0; n < nBlock; ++n){
+      bracket(solution,vPolicy[nBegin+n],vBracket[n],vWeight[n]);
+      vOutputFactor[n] = pow(vPolicy[nBegin+n],aalpha);
+      vExpected[n] = 0.0;
+    }
+    for (int nProductivityNextPeriod = 0; nProductivityNextPeriod < nGridProductivity; ++nProductivityNextPeriod){
+      const double probability = model.mTransition[nProductivity*nGridProductivity+nProductivityNextPeriod];
+      const double productivity = model.vProductivity[nProductivityNextPeriod];
+      if (probability == 0.0){
+	continue;
+      }
+      const double* policyNextPeriod = &solution.mPolicyFunction[nProductivityNextPeriod];
+      for (int n = 0; n < nBlock; ++n){
+	const double choice = (1-vWeight[n])*policyNextPeriod[vBracket[n]*nGridProductivity]+
+	  vWeight[n]*policyNextPeriod[(vBracket[n]+1)*nGridProductivity];
+	const double consumptionNextPeriod = productivity*vOutputFactor[n]-choice;
+	vExpected[n] += (consumptionNextPeriod > 0.0) ? probability*productivity/consumptionNextPeriod : HUGE_VAL;
+      }
+    }
+    for (int n = 0; n < nBlock; ++n){
+      // 1/c* = bbeta*aalpha*k'^(aalpha-1)*E[z'/c']
+      const double impliedConsumption = vPolicy[nBegin+n]/(bbeta*aalpha*vOutputFactor[n]*vExpected[n]);
+      const double error = std::abs(1.0-impliedConsumption/vConsumption[nBegin+n]);
+      vErrors[nBegin+n] = (vConsumption[nBegin+n] > 0.0 && vExpected[n] < HUGE_VAL) ? log10(max(error,1e-17)) : 0.0;
+    }
+  }
+}
+
+inline EulerErrorSummary summarize(std::vector<double>& vErrors){
+  EulerErrorSummary summary = {(long)vErrors.size(), -HUGE_VAL, 0.0, 0.0, 0.0, 0.0};
+  if (vErrors.empty()){
+    summary.maxError = 0.0;
+    return summary;
+  }
+  for (size_t n = 0; n < vErrors.size(); ++n){
+    summary.maxError = max(summary.maxError,vErrors[n]);
+    summary.meanError += vErrors[n]/vErrors.size();
+  }
+  const double fractions[3] = {0.5, 0.9, 0.99};
+  double* percentiles[3] = {&summary.percentile50, &summary.percentile90, &summary.percentile99};
+  for (int nPercentile = 0; nPercentile < 3; ++nPercentile){
+    const size_t rank = min((size_t)ceil(fractions[nPercentile]*vErrors.size()),vErrors.size())-1;
+    std::nth_element(vErrors.begin(),vErrors.begin()+rank,vErrors.end());
+    *percentiles[nPercentile] = vErrors[rank];
+  }
+  return summary;
+}
+
+} // namespace euler_detail
+
+// Euler equation errors of a solution of model, on its grid and on a dense set of off-grid
+// capital points, where the policy is interpolated linearly between grid points (the grid
+// is evenly spaced). The productivity states, split into blocks of 4096 capital points, go
+// to options.nThreads threads from a shared counter; each block computes the policy,
+// consumption and error of its points, and the summaries are taken once all are done.
+inline EulerErrors euler_errors(const Model& model, const Solution& solution, const EulerErrorOptions& options){
+  using namespace euler_detail;
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const int nGridCapital = solution.nGridCapital, nGridProductivity = solution.nGridProductivity;
+  const int nDense = max(options.densePoints,0);
+  const double first = solution.vGridCapital[0], last = solution.vGridCapital[nGridCapital-1];
+
+  // For each productivity state, the grid points and then the dense points
+  const int nColumn = nGridCapital+nDense;
+  std::vector<double> mPolicy((size_t)nColumn*nGridProductivity), mConsumption(mPolicy.size()), mErrors(mPolicy.size());
+  const int blockCapital = 4096;
+  const int nBlocksPerProductivity = (nColumn+blockCapital-1)/blockCapital;
+  std::atomic<int> nextBlock(0);
+  const auto worker = [&](){
+    for (int nBlock = nextBlock++; nBlock < nBlocksPerProductivity*nGridProductivity; nBlock = nextBlock++){
+      const int nProductivity = nBlock/nBlocksPerProductivity;
+      const int nBegin = nBlock%nBlocksPerProductivity*blockCapital, nEnd = min(nBegin+blockCapital,nColumn);
+      const size_t nOffset = (size_t)nProductivity*nColumn;
+      for (int n = nBegin; n < nEnd; ++n){
+	double capital, policy;
+	if (n < nGridCapital){
+	  capital = solution.vGridCapital[n];
+	  policy = solution.policy(n,nProductivity);
+	}
+	else{
+	  capital = first+(last-first)*(n-nGridCapital+0.5)/nDense;
+	  int nBracket;
+	  double weight;
+	  bracket(solution,capital,nBracket,weight);
+	  policy = (1-weight)*solution.policy(nBracket,nProductivity)+weight*solution.policy(nBracket+1,nProductivity);
+	}
+	mPolicy[nOffset+n] = policy;
+	mConsumption[nOffset+n] = model.vProductivity[nProductivity]*pow(capital,model.aalpha)-policy;
+      }
+      block_errors(model,solution,nProductivity,nEnd-nBegin,&mPolicy[nOffset+nBegin],&mConsumption[nOffset+nBegin],
+		   &mErrors[nOffset+nBegin]);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int nThread = 1; nThread < options.nThreads; ++nThread){
+    workers.push_back(std::thread(worker));
+  }
+  worker();
+  for (size_t nThread = 0; nThread < workers.size(); ++nThread){
+    workers[nThread].join();
+  }
+
+  std::vector<double> vGridErrors, vDenseErrors;
+  vGridErrors.reserve((size_t)nGridCapital*nGridProductivity);
+  vDenseErrors.reserve((size_t)nDense*nGridProductivity);
+  for (int nProductivity = 0; nProductivity < nGridProductivity; ++nProductivity){
+    const double* column = &mErrors[(size_t)nProductivity*nColumn];
+    vGridErrors.insert(vGridErrors.end(),column,column+nGridCapital);
+    vDenseErrors.insert(vDenseErrors.end(),column+nGridCapital,column+nColumn);
+  }
+  EulerErrors errors;
+  errors.grid = summarize(vGridErrors);
+  errors.dense = summarize(vDenseErrors);
+  errors.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  return errors;
+}
+
+} // namespace rbc
+
+#endif
@@ -0,0 +1,82 @@
+//============================================================================
+// Name        : RBC_CPP_Threads.cpp
+// Description : Basic RBC model with full depreciation, driver for RBC_CPP_Solver.hpp
+// Date        : July 21, 2013
+// Corrected by: Dziubinski, Matt P, matt@math.aau.dk 
+//============================================================================
+
+#include <algorithm>    // std::max, std::min
+#include <chrono>       // time measurement
+#include <cmath>        // std::log, std::pow, std::ceil
+#include <cstddef>      // std::size_t
+#include <cstdlib>      // std::atoi
+#include <cstring>      // std::strcmp
+#include <iostream>
+
+#include "RBC_CPP_Solver.hpp"
+
+// Usage: RBC_CPP_Threads [nThreads [nGridCapital [supnorm|bounds]]]
+// With nThreads > 1 the maximization step is split across productivity states and
+// contiguous capital blocks (compile with -pthread); the default runs the serial code.
+// With nGridCapital the grid spans 0.5 to 1.5 times steady state capital; without it
+// the original grid with a step of 0.00001 is used (pass 0 to keep it with bounds).
+// With bounds, iteration stops when the policy is stable and the MacQueen-Porteus bounds
+// on the fixed point are within tolerance, instead of on the sup norm of the update.
+// The solver itself is in RBC_CPP_Solver.hpp.
+int main(int argc, char* argv[])
+{
+	const auto time_0 = std::chrono::steady_clock::now();
+
+	///////////////////////////////////////////////////////////////////////////////////////////
+	// 1. Calibration
+	///////////////////////////////////////////////////////////////////////////////////////////
+
+	rbc::Model model;
+	model.aalpha = 1. / 3.;          // Elasticity of output w.r.t. capital
+	model.bbeta = 0.95;              // Discount factor;
+
+	if ((argc > 2) && (std::atoi(argv[2]) != 0))
+	{
+		model.nGridCapital = std::max(2, std::atoi(argv[2]));
+		model.defaultGrid = false;
+	}
+
+	rbc::Options options;
+	options.nThreads = (argc > 1) ? std::max(1, std::atoi(argv[1])) : 1;
+	options.boundsConvergence = (argc > 3) && (std::strcmp(argv[3], "bounds") == 0);
+	options.progress = &std::cout;
+
+	///////////////////////////////////////////////////////////////////////////////////////////
+	// 2. Steady State
+	///////////////////////////////////////////////////////////////////////////////////////////
+
+	const auto capitalSteadyState = model.capital_steady_state();
+	const auto outputSteadyState = std::pow(capitalSteadyState, model.aalpha);
+	const auto consumptionSteadyState = outputSteadyState - capitalSteadyState;
+
+	std::cout << "Output = " << outputSteadyState << ", Capital = " << capitalSteadyState << ", Consumption = " << consumptionSteadyState << "\n";
+
+	// 3. Main iteration
+
+	rbc::Solver solver;
+	const auto& solution = solver.solve(model, options);
+
+	std::cout << "Iteration = " << solution.iterations << ", Sup Diff = " << solution.supDiff << "\n";
+	if (options.boundsConvergence)
+	{
+		// Once the policy is stable the plain update shrinks by bbeta per iteration
+		const auto remaining = (solution.plainDifference > options.tolerance) ? std::ceil(std::log(options.tolerance / solution.plainDifference) / std::log(model.bbeta)) : 0.;
+		std::cout << "Iterations saved versus the sup norm rule (estimated) = " << static_cast<std::size_t>(remaining) << "\n";
+	}
+	endl(std::cout);
+	std::cout << "My check = " << solution.policy(std::min(999, model.nGridCapital - 1), 2) << "\n";
+	std::cout << "Policy checksum = " << std::hex << solution.policy_checksum() << std::dec << "\n";
+	endl(std::cout);
+
+	const auto time_1 = std::chrono::steady_clock::now();
+	const auto elapsed_seconds = std::chrono::duration_cast<std::chrono::duration<double>>(time_1 - time_0).count();
+	std::cout << "Elapsed time is   = " << elapsed_seconds << " seconds." << std::endl;
+	endl(std::cout);
+
+	return 0;
+}
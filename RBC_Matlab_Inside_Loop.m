@@ -48,6 +48,7 @@ nGridProductivity = length(vProductivity);
 mOutput           = zeros(nGridCapital,nGridProductivity);
 mValueFunction    = zeros(nGridCapital,nGridProductivity);
 expectedValueFunction = zeros(nGridCapital,nGridProductivity);
+mPolicyIndex          = ones(nGridCapital,nGridProductivity,'int32');
 
 %% 4. We pre-build output for each point in the grid
 
@@ -63,7 +64,9 @@ while (maxDifference>tolerance)
     
     expectedValueFunction = mValueFunction*mTransition';    
     
-    [mValueFunctionNew,mPolicyFunction] = inside_loop_mex(vGridCapital,mOutput,expectedValueFunction);
+    % The policy indices of the last iteration warm-start the walk; the mex file runs the
+    % productivity states on one thread per core and reads its inputs without copying them
+    [mValueFunctionNew,mPolicyFunction,mPolicyIndex] = inside_loop_mex(vGridCapital,mOutput,expectedValueFunction,bbeta,mPolicyIndex);
     
     maxDifference = max(max(abs(mValueFunctionNew-mValueFunction)));
     mValueFunction = mValueFunctionNew;
@@ -1,11 +1,20 @@
 /*********************************************************************
  * inside_loop_mex.cpp
  *
- * 
+ * [mValueFunctionNew, mPolicyFunction, mPolicyIndex] =
+ *     inside_loop_mex(vGridCapital, mOutput, expectedValueFunction, bbeta, mPolicyIndex, nThreads)
+ *
+ * bbeta (default 0.95), the warm-start mPolicyIndex and nThreads (default one per core) are
+ * optional. mPolicyIndex holds 1-based grid indices (int32 on output, int32 or double on
+ * input), such as those returned by the previous iteration: where the old choice is still on
+ * the way up the walk starts from it instead of climbing to it again.
+ *
  * Keep in mind:
  * <> Use 0-based indexing as always in C or C++
  * <> Indexing is column-based as in Matlab (not row-based as in C)
  * <> Use linear indexing. [x*dimy+y] instead of [x][y]
+ * <> The inputs are read in place, never copied, and never written
+ * <> Only the calling thread may call the mx/mex API; the workers see plain pointers
  *
  * Adapted by: Pablo Cuba-Borda. June 2nd, 2014.
  *
@@ -21,6 +30,13 @@
 #include <math.h>       // power
 #include <cmath>        // abs
 #include <ctime>        // time
+#include <algorithm>    // min, max
+#include <vector>
+#include <thread>       // thread pool
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
 
 
 /* Definitions to keep compatibility with earlier versions of ML */
@@ -45,87 +61,242 @@ typedef int mwSignedIndex;
 #define MWINDEX_MIN   0UL
 #endif
 
+// Threads that live from the first call until the MEX file is cleared, so that an iteration
+// does not pay for creating them. run() hands out tasks 0 to nTasks-1 from a shared counter
+// to the workers and the calling thread and returns when all are done.
+class ThreadPool{
+public:
+    ThreadPool() : job(NULL), nTasks(0), nPending(0), nActive(0), generation(0), stopping(false) {}
+    ~ThreadPool(){ stop(); }
+
+    void run(int nThreads, int tasks, const std::function<void(int)>& task){
+        nThreads = std::max(1,std::min(nThreads,tasks));
+        while ((int)workers.size() < nThreads-1){
+            workers.push_back(std::thread(&ThreadPool::work,this));
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        job = &task;
+        nTasks = tasks;
+        nextTask = 0;
+        nPending = tasks;
+        ++generation;
+        wake.notify_all();
+        lock.unlock();
+        take_tasks(task,tasks);
+        lock.lock();
+        // No worker may still be taking tasks when the next call resets the counter
+        done.wait(lock,[this](){ return nPending == 0 && nActive == 0; });
+        job = NULL;
+    }
+
+    void stop(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t nWorker = 0; nWorker < workers.size(); ++nWorker){
+            workers[nWorker].join();
+        }
+        workers.clear();
+        stopping = false;
+    }
+
+private:
+    void take_tasks(const std::function<void(int)>& task, int tasks){
+        int nCompleted = 0;
+        for (int nTask = nextTask++; nTask < tasks; nTask = nextTask++){
+            task(nTask);
+            ++nCompleted;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        nPending -= nCompleted;
+        if (nPending == 0){
+            done.notify_all();
+        }
+    }
+
+    void work(){
+        long seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true){
+            wake.wait(lock,[&](){ return stopping || generation != seen; });
+            if (stopping){
+                return;
+            }
+            seen = generation;
+            if (job == NULL){
+                continue; // Woken after the call it was meant for had finished
+            }
+            const std::function<void(int)>* task = job;
+            const int tasks = nTasks;
+            ++nActive;
+            lock.unlock();
+            take_tasks(*task,tasks);
+            lock.lock();
+            --nActive;
+            done.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(int)>* job;
+    int nTasks, nPending, nActive;
+    std::atomic<int> nextTask;
+    long generation;
+    bool stopping;
+};
+
+static ThreadPool pool;
+
+static void stop_pool(void){
+    pool.stop();
+}
+
+// One column of the maximization: the arrays of productivity state nProductivity
+struct Column{
+    const double* vGridCapital;
+    const double* output;
+    const double* expectedValue;
+    double bbeta;
+    int nGridCapital;
+
+    double value(int nCapital, int nCapitalNextPeriod) const {
+        const double consumption = output[nCapital]-vGridCapital[nCapitalNextPeriod];
+        return (1-bbeta)*log(consumption)+bbeta*expectedValue[nCapitalNextPeriod];
+    }
+
+    // Whether moving from nCapitalNextPeriod to the next grid point raises the value (false
+    // where consumption turns negative and the value is NaN)
+    bool improving(int nCapital, int nCapitalNextPeriod) const {
+        return nCapitalNextPeriod+1 < nGridCapital && value(nCapital,nCapitalNextPeriod+1) > value(nCapital,nCapitalNextPeriod);
+    }
+};
+
+// The choice of the walk for the state before the first of a block: the value is concave in
+// the choice, so the first point that does not improve is found by bisection
+static int first_non_improving(const Column& column, int nCapital){
+    int low = 0, high = column.nGridCapital-1;
+    while (low < high){
+        const int middle = low+(high-low)/2;
+        if (column.improving(nCapital,middle)){
+            low = middle+1;
+        }
+        else{
+            high = middle;
+        }
+    }
+    return low;
+}
+
 // This is the gateway function
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
-   
-//declare input-output variables
-    mxArray *v_in_1, *v_in_2, *v_in_3, *m_out_1, *m_out_2;
-    // input arrays
-    double *vGridCapital, *mOutput, *expectedValueFunction;
-    // output arrays
-    double *mValueFunctionNew,*mPolicyFunction;
-    
-// local variables
-    int nGridCapital, nGridProductivity, gridCapitalNextPeriod, numdims;
-    double valueHighSoFar, valueProvisional, consumption, capitalChoice;
-
-// declare counters    
-    int nProductivity,nCapital,nCapitalNextPeriod;
-
-// declare constants types and parameters    
-    const double bbeta  = 0.95;
-    const mwSize *dims;
-
-//associate inputs
-    v_in_1 = mxDuplicateArray(prhs[0]);
-    v_in_2 = mxDuplicateArray(prhs[1]);
-    v_in_3 = mxDuplicateArray(prhs[2]);
 
-//figure out dimensions of all inputs: rows(mxGetM) and columns(mxGetN)
+// declare constants types and parameters
+    const int defaultThreads = std::max(1,(int)std::thread::hardware_concurrency());
+
+    if (nrhs < 3){
+        mexErrMsgIdAndTxt("inside_loop_mex:arguments","Usage: inside_loop_mex(vGridCapital, mOutput, expectedValueFunction [, bbeta [, mPolicyIndex [, nThreads]]])");
+    }
 
-    // Dimensions of expectedValueFunction
-    numdims = mxGetNumberOfDimensions(prhs[2]);
+//figure out dimensions of all inputs: rows(mxGetM) and columns(mxGetN)
 
     // Dimensions of capital grid
-    nGridCapital = (int)mxGetM(prhs[2]); 
-    
+    const int nGridCapital = (int)mxGetM(prhs[2]);
+
     // Dimensions of productivity grid
-    nGridProductivity = (int)mxGetN(prhs[2]); 
-    
+    const int nGridProductivity = (int)mxGetN(prhs[2]);
+    const mwSize nStates = (mwSize)nGridCapital*nGridProductivity;
+
+    if (!mxIsDouble(prhs[0]) || !mxIsDouble(prhs[1]) || !mxIsDouble(prhs[2]) || mxIsComplex(prhs[0]) || mxIsComplex(prhs[1]) ||
+        mxIsComplex(prhs[2]) || (int)mxGetNumberOfElements(prhs[0]) != nGridCapital || mxGetNumberOfElements(prhs[1]) != nStates){
+        mexErrMsgIdAndTxt("inside_loop_mex:arguments","vGridCapital, mOutput and expectedValueFunction must be real doubles with nGridCapital rows");
+    }
+
+    const double bbeta = (nrhs > 3 && !mxIsEmpty(prhs[3])) ? mxGetScalar(prhs[3]) : 0.95;
+    const int nThreads = (nrhs > 5 && !mxIsEmpty(prhs[5])) ? std::max(1,(int)mxGetScalar(prhs[5])) : defaultThreads;
+
+    // Warm start: 0-based copy of the indices, which may be int32 or double
+    std::vector<int> vWarmStart;
+    if (nrhs > 4 && !mxIsEmpty(prhs[4])){
+        if (mxGetNumberOfElements(prhs[4]) != nStates || !(mxIsInt32(prhs[4]) || mxIsDouble(prhs[4]))){
+            mexErrMsgIdAndTxt("inside_loop_mex:arguments","mPolicyIndex must be int32 or double with the size of expectedValueFunction");
+        }
+        vWarmStart.resize(nStates);
+        for (mwSize nState = 0; nState < nStates; ++nState){
+            const int index = mxIsInt32(prhs[4]) ? ((const int*)mxGetData(prhs[4]))[nState] : (int)mxGetPr(prhs[4])[nState];
+            vWarmStart[nState] = std::min(std::max(index-1,0),nGridCapital-1);
+        }
+    }
+
+//associate inputs: read in place
+    const double* vGridCapital = mxGetPr(prhs[0]);
+    const double* mOutput = mxGetPr(prhs[1]);
+    const double* expectedValueFunction = mxGetPr(prhs[2]);
+
 //associate outputs
-    m_out_1 = plhs[0] = mxCreateDoubleMatrix(nGridCapital,nGridProductivity,mxREAL);
-    m_out_2 = plhs[1] = mxCreateDoubleMatrix(nGridCapital,nGridProductivity,mxREAL);
-
-//associate pointers
-    vGridCapital = mxGetPr(v_in_1);
-    mOutput = mxGetPr(v_in_2);
-    expectedValueFunction = mxGetPr(v_in_3);
-    mValueFunctionNew = mxGetPr(m_out_1);
-    mPolicyFunction = mxGetPr(m_out_2);
-    
-//main Loop
-    for (nProductivity = 0;nProductivity<nGridProductivity;++nProductivity){
-    
+    plhs[0] = mxCreateDoubleMatrix(nGridCapital,nGridProductivity,mxREAL);
+    plhs[1] = mxCreateDoubleMatrix(nGridCapital,nGridProductivity,mxREAL);
+    std::vector<int> vPolicyIndex;
+    int* mPolicyIndex;
+    if (nlhs > 2){
+        plhs[2] = mxCreateNumericMatrix(nGridCapital,nGridProductivity,mxINT32_CLASS,mxREAL);
+        mPolicyIndex = (int*)mxGetData(plhs[2]);
+    }
+    else{
+        vPolicyIndex.resize(nStates);
+        mPolicyIndex = &vPolicyIndex[0];
+    }
+    double* mValueFunctionNew = mxGetPr(plhs[0]);
+    double* mPolicyFunction = mxGetPr(plhs[1]);
+    const int* warmStart = vWarmStart.empty() ? NULL : &vWarmStart[0];
+
+//main Loop: each productivity state is split into blocks, a few per thread, taken by the
+//pool. A block starts where the serial walk would arrive (first_non_improving for the state
+//before it) and writes only the values and policies of its own states.
+    const int nBlocksPerProductivity = (nThreads > 1) ? std::max(1,(4*nThreads+nGridProductivity-1)/nGridProductivity) : 1;
+    const int nCapitalPerBlock = (nGridCapital+nBlocksPerProductivity-1)/nBlocksPerProductivity;
+
+    const std::function<void(int)> maximizeBlock = [&](int nBlock){
+        const int nProductivity = nBlock/nBlocksPerProductivity;
+        const int nCapitalBegin = nBlock%nBlocksPerProductivity*nCapitalPerBlock;
+        const int nCapitalEnd = std::min(nCapitalBegin+nCapitalPerBlock,nGridCapital);
+        const Column column = {vGridCapital, &mOutput[nProductivity*nGridCapital], &expectedValueFunction[nProductivity*nGridCapital],
+                               bbeta, nGridCapital};
+
         // We start from previous choice (monotonicity of policy function)
-        gridCapitalNextPeriod = 0;
-        
-        for (nCapital = 0;nCapital<nGridCapital;++nCapital){
-          
-            valueHighSoFar = -1000.0;
-            capitalChoice  = vGridCapital[0];
-            
-            for (nCapitalNextPeriod = gridCapitalNextPeriod;nCapitalNextPeriod<nGridCapital;++nCapitalNextPeriod){
-                
-                consumption = mOutput[nProductivity*nGridCapital+nCapital]-vGridCapital[nCapitalNextPeriod];
-                valueProvisional = (1-bbeta)*log(consumption)+bbeta*expectedValueFunction[nProductivity*nGridCapital+nCapitalNextPeriod];
-                
-                if (valueProvisional>valueHighSoFar){
-                    valueHighSoFar = valueProvisional;
-                    capitalChoice = vGridCapital[nCapitalNextPeriod];
-                    gridCapitalNextPeriod = nCapitalNextPeriod;
-                }
-                else{
-                    break; // We break when we have achieved the max
+        int gridCapitalNextPeriod = (nCapitalBegin == 0) ? 0 : first_non_improving(column,nCapitalBegin-1);
+
+        for (int nCapital = nCapitalBegin; nCapital < nCapitalEnd; ++nCapital){
+
+            // The warm start is skipped to when the value still rises into it
+            int nCapitalNextPeriod = gridCapitalNextPeriod;
+            if (warmStart != NULL){
+                const int start = warmStart[nProductivity*nGridCapital+nCapital];
+                if (start > gridCapitalNextPeriod && column.improving(nCapital,start-1)){
+                    nCapitalNextPeriod = start;
                 }
-                
+            }
+            while (column.improving(nCapital,nCapitalNextPeriod)){
+                ++nCapitalNextPeriod; // We break when we have achieved the max
+            }
+
+            // With a NaN value (no positive consumption) nothing is chosen, as in the original loop
+            const double valueHighSoFar = column.value(nCapital,nCapitalNextPeriod);
+            if (valueHighSoFar == valueHighSoFar){
                 mValueFunctionNew[nProductivity*nGridCapital+nCapital] = valueHighSoFar;
-                mPolicyFunction[nProductivity*nGridCapital+nCapital] = capitalChoice;
+                mPolicyFunction[nProductivity*nGridCapital+nCapital] = vGridCapital[nCapitalNextPeriod];
+                mPolicyIndex[nProductivity*nGridCapital+nCapital] = nCapitalNextPeriod+1;
+                gridCapitalNextPeriod = nCapitalNextPeriod;
             }
-            
         }
-        
-    }
-    
+    };
+
+    mexAtExit(stop_pool);
+    pool.run(nThreads,nGridProductivity*nBlocksPerProductivity,maximizeBlock);
+
     return;
 }